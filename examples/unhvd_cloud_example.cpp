@@ -22,7 +22,7 @@
 using namespace std;
 
 void main_loop(unhvd *network_decoder);
-int process_user_input(int argc, char **argv, unhvd_hw_config *hw_config, unhvd_net_config *net_config);
+int process_user_input(int argc, char **argv, unhvd_hw_config *hw_config, unhvd_net_config *net_config, unhvd_publish_config *publish_config);
 
 //network configuration
 const char *IP=NULL; //listen on or NULL (listen on any)
@@ -50,6 +50,19 @@ const float FX=426.768;
 const float FY=426.768;
 const float DEPTH_UNIT=0.0001;
 
+//pipeline configuration
+const int SYNC=1; //unproject only matched depth and texture
+const int MAX_SKEW=0; //frames of the set have to have the same timestamp
+
+//re-streaming configuration, see unhvd_cloud_subscriber_example
+const char *PUBLISH_IP=NULL; //listen on or NULL (listen on any)
+const uint16_t PUBLISH_PORT=0; //optionally input through CLI, 0 to not publish
+const float QUANTIZATION=0.001f; //millimeter precision for meters
+
+//thread scheduling, e.g. pin decoding thread away from rendering with mask and SCHED_FIFO
+const unhvd_thread_config DECODER_THREAD={"unhvd-decoder", 0, UNHVD_SCHED_DEFAULT, 0};
+const unhvd_thread_config PUBLISHER_THREAD={"unhvd-publisher", 0, UNHVD_SCHED_DEFAULT, 0};
+
 //we simpulate application rendering at framerate
 const int FRAMERATE = 30;
 
@@ -63,11 +76,17 @@ int main(int argc, char **argv)
 	                           };
 
 	unhvd_depth_config depth_config = {PPX, PPY, FX, FY, DEPTH_UNIT};
+	unhvd_publish_config publish_config = {PUBLISH_IP, PUBLISH_PORT, QUANTIZATION};
+	unhvd_pipeline_config pipeline_config = {SYNC, MAX_SKEW, NULL, NULL, 0, NULL,
+		DECODER_THREAD, PUBLISHER_THREAD};
 
-	if(process_user_input(argc, argv, hw_config, &net_config) != 0)
+	if(process_user_input(argc, argv, hw_config, &net_config, &publish_config) != 0)
 		return 1;
 
-	unhvd *network_decoder = unhvd_init(&net_config, hw_config, 2, &depth_config);
+	if(publish_config.port) //publishing is opt-in
+		pipeline_config.publish = &publish_config;
+
+	unhvd *network_decoder = unhvd_init_pipeline(&net_config, hw_config, 2, &depth_config, &pipeline_config);
 
 	if(!network_decoder)
 	{
@@ -112,14 +131,15 @@ void main_loop(unhvd *network_decoder)
 	}
 }
 
-int process_user_input(int argc, char **argv, unhvd_hw_config *hw_config, unhvd_net_config *net_config)
+int process_user_input(int argc, char **argv, unhvd_hw_config *hw_config, unhvd_net_config *net_config, unhvd_publish_config *publish_config)
 {
 	if(argc < 3)
 	{
-		fprintf(stderr, "Usage: %s <port> <hardware> [device] [width] [height] \n\n", argv[0]);
+		fprintf(stderr, "Usage: %s <port> <hardware> [device] [width] [height] [publish port]\n\n", argv[0]);
 		fprintf(stderr, "examples: \n");
 		fprintf(stderr, "%s 9768 vaapi /dev/dri/renderD128 640 360\n", argv[0]);
 		fprintf(stderr, "%s 9768 vaapi /dev/dri/renderD128 848 480\n", argv[0]);
+		fprintf(stderr, "%s 9768 vaapi /dev/dri/renderD128 848 480 9769\n", argv[0]);
 
 		return 1;
 	}
@@ -138,5 +158,7 @@ int process_user_input(int argc, char **argv, unhvd_hw_config *hw_config, unhvd_
 	if(argc > 4) hw_config[1].width = atoi(argv[4]);
 	if(argc > 5) hw_config[1].height = atoi(argv[5]);
 
+	if(argc > 6) publish_config->port = atoi(argv[6]);
+
 	return 0;
 }
@@ -0,0 +1,158 @@
+/*
+ * UNHVD point cloud subscriber example
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Receives point clouds re-streamed by UNHVD (e.g. unhvd_cloud_example)
+ * - connects to publisher over TCP
+ * - decodes point clouds with unhvd_cloud_codec
+ * - prints compression ratio against raw float3 + color32 and decoding time
+ */
+
+#include "../unhvd_cloud_codec.h"
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h> //atoi
+#include <string.h> //memset
+#include <sys/socket.h> //note that this is not portable
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+int main_loop(int fd);
+bool receive_all(int fd, uint8_t *data, int size);
+int process_user_input(int argc, char **argv, const char **ip, uint16_t *port);
+
+//network configuration
+const char *IP="127.0.0.1"; //publisher IP
+const uint16_t PORT=9769; //publisher port
+
+int main(int argc, char **argv)
+{
+	const char *ip = IP;
+	uint16_t port = PORT;
+
+	if(process_user_input(argc, argv, &ip, &port) != 0)
+		return 1;
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if(fd == -1 || inet_pton(AF_INET, ip, &address.sin_addr) != 1 ||
+		connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		cerr << "failed to connect to publisher" << endl;
+		return 2;
+	}
+
+	int status = main_loop(fd);
+
+	close(fd);
+	return status;
+}
+
+int main_loop(int fd)
+{
+	unhvd_cloud_codec *decoder = unhvd_cloud_codec_init(0);
+
+	if(!decoder)
+		return 3;
+
+	vector<uint8_t> message;
+	unhvd_point_cloud cloud = {NULL, NULL, 0, 0};
+
+	while(true)
+	{
+		unhvd_cloud_header header;
+
+		message.resize(UNHVD_CLOUD_HEADER_SIZE);
+
+		if(!receive_all(fd, message.data(), UNHVD_CLOUD_HEADER_SIZE) ||
+			unhvd_cloud_parse_header(message.data(), &header) != UNHVD_OK)
+			break;
+
+		message.resize(UNHVD_CLOUD_HEADER_SIZE + header.payload_size);
+
+		if(!receive_all(fd, message.data() + UNHVD_CLOUD_HEADER_SIZE, header.payload_size))
+			break;
+
+		if(cloud.size < header.points)
+		{
+			delete [] cloud.data;
+			delete [] cloud.colors;
+			cloud.data = new float3[header.points];
+			cloud.colors = new color32[header.points];
+			cloud.size = header.points;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		if(unhvd_cloud_decode(decoder, message.data(), message.size(), &cloud) != UNHVD_OK)
+			break;
+
+		const long decode_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+		const double raw = (double)cloud.used * (sizeof(float3) + sizeof(color32));
+
+		//do something with:
+		// - cloud.data
+		// - cloud.colors
+		// - cloud.used
+		cout << "pts " << header.pts <<
+		" points " << cloud.used << " bytes " << message.size() <<
+		" ratio " << (message.size() ? raw / message.size() : 0.0) << " decode " << decode_us << " us" << endl;
+	}
+
+	cerr << "connection closed or corrupted data" << endl;
+
+	delete [] cloud.data;
+	delete [] cloud.colors;
+	unhvd_cloud_codec_close(decoder);
+	return 0;
+}
+
+bool receive_all(int fd, uint8_t *data, int size)
+{
+	while(size)
+	{
+		const ssize_t received = recv(fd, data, size, 0);
+
+		if(received <= 0)
+			return false;
+
+		data += received;
+		size -= received;
+	}
+
+	return true;
+}
+
+int process_user_input(int argc, char **argv, const char **ip, uint16_t *port)
+{
+	if(argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <ip> <port>\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 127.0.0.1 9769\n", argv[0]);
+
+		return 1;
+	}
+
+	*ip = argv[1];
+	*port = atoi(argv[2]);
+
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * UNHVD steady state allocation test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Counts heap allocations (malloc family and operator new) made by the decoding thread
+ * outside of synthetic frame source and checks there are none after warm-up with:
+ * - set assembly, callback, unprojection with levels of detail, culling and summary
+ * - point cloud re-streaming to loopback subscriber
+ *
+ * With recording frames are referenced, the only allowed allocations are
+ * buffer references (AVBufferRef) of recorded frames.
+ *
+ * Allocation hooks replace glibc allocator entry points, don't build with sanitizers.
+ */
+
+#include "unhvd_test_common.h"
+#include "../unhvd_cloud_codec.h"
+
+#include <atomic>
+#include <vector>
+#include <new>
+#include <errno.h>
+
+using namespace std;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static thread_local bool decoding_thread = false; //set by source on first call
+static thread_local bool in_source = false;
+static std::atomic<uint64_t> allocations(0);
+
+static inline void count_allocation()
+{
+	if(decoding_thread && !in_source)
+		++allocations;
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+	count_allocation();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count_allocation();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count_allocation();
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	count_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	count_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	count_allocation();
+
+	if(alignment % sizeof(void*) || (alignment & (alignment - 1)))
+		return EINVAL;
+
+	*ptr = __libc_memalign(alignment, size);
+
+	return *ptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+}
+
+void *operator new(size_t size)
+{
+	count_allocation();
+
+	void *ptr = __libc_malloc(size ? size : 1);
+
+	if(ptr == NULL)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	count_allocation();
+	return __libc_malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	__libc_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+	__libc_free(ptr);
+}
+
+const int WIDTH = 848, HEIGHT = 480;
+const int TEMPLATES = 4;
+const int WARMUP_SETS = 60, MEASURED_SETS = 300;
+
+// references depth and texture templates, number of valid depth pixels differs between templates
+struct test_source
+{
+	AVFrame *depth[TEMPLATES];
+	AVFrame *texture;
+	AVFrame *lent[2];
+	int64_t pts;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	decoding_thread = true;
+	in_source = true;
+
+	test_source *s = (test_source*)user;
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+	av_frame_ref(s->lent[0], s->depth[s->pts % TEMPLATES]);
+	av_frame_ref(s->lent[1], s->texture);
+	s->lent[0]->pts = s->lent[1]->pts = s->pts++;
+
+	frames[0] = s->lent[0];
+	frames[1] = s->lent[1];
+	frames[2] = NULL;
+
+	//about 500 sets per second
+	std::this_thread::sleep_for(std::chrono::microseconds(2000));
+
+	in_source = false;
+	return NHVD_OK;
+}
+
+static void test_callback(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user)
+{
+	std::atomic<uint64_t> *points = (std::atomic<uint64_t>*)user;
+
+	if(pc)
+		*points += pc->used;
+}
+
+// loopback subscriber reading whole messages
+struct test_subscriber
+{
+	int fd;
+	std::atomic<int> messages;
+	std::atomic<bool> keep_working;
+	thread reader;
+};
+
+static void test_subscriber_read(test_subscriber *s)
+{
+	vector<uint8_t> message;
+	uint8_t header_data[UNHVD_CLOUD_HEADER_SIZE];
+	unhvd_cloud_header header;
+
+	while(s->keep_working && unhvd_test_read_all(s->fd, header_data, sizeof(header_data)))
+	{
+		UNHVD_CHECK(unhvd_cloud_parse_header(header_data, &header) == UNHVD_OK);
+
+		message.resize(header.payload_size);
+
+		if(!unhvd_test_read_all(s->fd, message.data(), message.size()))
+			break;
+
+		++s->messages;
+	}
+}
+
+static void test_subscriber_start(test_subscriber *s, uint16_t port)
+{
+	s->fd = unhvd_test_connect(port);
+	s->messages = 0;
+	s->keep_working = true;
+	s->reader = thread(test_subscriber_read, s);
+}
+
+static void test_subscriber_stop(test_subscriber *s)
+{
+	s->keep_working = false;
+	shutdown(s->fd, SHUT_RDWR);
+	s->reader.join();
+	close(s->fd);
+}
+
+static void test_source_init(test_source *s)
+{
+	for(int t=0;t<TEMPLATES;++t)
+	{
+		s->depth[t] = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+
+		for(int y=0;y<HEIGHT;++y)
+		{
+			uint16_t *row = (uint16_t*)(s->depth[t]->data[0] + y * s->depth[t]->linesize[0]);
+
+			//every template has different number of valid (non zero) pixels
+			for(int x=0;x<WIDTH;++x)
+				row[x] = y % (t + 2) == 0 ? 0 : 10000 + 10 * x + y;
+		}
+	}
+
+	s->texture = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_texture(s->texture, 0xFF336699);
+
+	s->lent[0] = av_frame_alloc();
+	s->lent[1] = av_frame_alloc();
+	s->pts = 0;
+}
+
+// number of buffer references taken by referencing the set
+static int test_source_refs(const test_source *s)
+{
+	int refs = 0;
+
+	for(int i=0;i<8;++i)
+		refs += (s->depth[0]->buf[i] != NULL) + (s->texture->buf[i] != NULL);
+
+	return refs;
+}
+
+static void test_source_close(test_source *s)
+{
+	for(int t=0;t<TEMPLATES;++t)
+		av_frame_free(&s->depth[t]);
+
+	av_frame_free(&s->texture);
+	av_frame_free(&s->lent[0]);
+	av_frame_free(&s->lent[1]);
+}
+
+static void test_steady_state(bool record)
+{
+	const uint16_t port = unhvd_test_port();
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = WIDTH / 2;
+	depth.ppy = HEIGHT / 2;
+	depth.fx = depth.fy = 420.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	//slab along z, unbounded in x and y
+	unhvd_depth_ext_config depth_ext;
+	memset(&depth_ext, 0, sizeof(depth_ext));
+	depth_ext.box_center[2] = 5.0f;
+	depth_ext.box_half_size[2] = 4.0f;
+	depth_ext.summary = 1;
+	depth_ext.histogram_max = 10.0f;
+	depth_ext.lod_levels = UNHVD_MAX_LOD_LEVELS - 1;
+	depth_ext.lod_method = UNHVD_LOD_MEDIAN;
+
+	unhvd_publish_config publish;
+	memset(&publish, 0, sizeof(publish));
+	publish.ip = "127.0.0.1";
+	publish.port = port;
+
+	unhvd_record_config recording = {"/dev/null", 4};
+
+	std::atomic<uint64_t> points(0);
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sync = 1;
+	pipeline.callback = test_callback;
+	pipeline.callback_user = &points;
+	pipeline.publish = &publish;
+	pipeline.record = record ? &recording : NULL;
+	pipeline.depth_ext = &depth_ext;
+
+	test_source source;
+	test_source_init(&source);
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 2, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	test_subscriber subscriber;
+	test_subscriber_start(&subscriber, port);
+
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [](const unhvd_stats &s){ return s.sets >= WARMUP_SETS; }));
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [&subscriber](const unhvd_stats &s){ return subscriber.messages >= 10; }));
+
+	unhvd_stats before, after;
+	UNHVD_CHECK(unhvd_get_stats(u, &before) == UNHVD_OK);
+	const uint64_t allocations_before = allocations;
+
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [&before](const unhvd_stats &s){ return s.sets >= before.sets + MEASURED_SETS; }, 30000));
+
+	const uint64_t allocations_after = allocations;
+	UNHVD_CHECK(unhvd_get_stats(u, &after) == UNHVD_OK);
+
+	printf("%s: %llu sets, %llu published, %llu recorded, %llu allocations in steady state\n",
+		record ? "recording" : "publishing",
+		(unsigned long long)(after.sets - before.sets), (unsigned long long)(after.published - before.published),
+		(unsigned long long)(after.recorded - before.recorded), (unsigned long long)(allocations_after - allocations_before));
+
+	UNHVD_CHECK(after.published > before.published);
+	UNHVD_CHECK(!record || after.recorded > before.recorded);
+	UNHVD_CHECK(after.point_cloud_allocations == before.point_cloud_allocations);
+	UNHVD_CHECK(points > 0);
+
+	const uint64_t steady = allocations_after - allocations_before;
+
+	if(!record)
+		UNHVD_CHECK(steady == 0);
+	else
+	{	//sets recorded around the measured interval may be counted too
+		const uint64_t recorded = after.recorded - before.recorded + 2 * recording.queue_size;
+		UNHVD_CHECK(steady <= recorded * test_source_refs(&source));
+	}
+
+	unhvd_close(u);
+	test_subscriber_stop(&subscriber);
+	test_source_close(&source);
+}
+
+int main(int argc, char **argv)
+{
+	test_steady_state(false);
+	test_steady_state(true);
+
+	printf("unhvd allocation test passed\n");
+	return 0;
+}
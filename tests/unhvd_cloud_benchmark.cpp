@@ -0,0 +1,245 @@
+/*
+ * UNHVD point cloud re-streaming benchmark
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Unprojects synthetic 848x480 depth + texture sets and re-streams them
+ * to loopback subscriber which decodes every message. Reports:
+ * - encode time per point cloud (average and maximum)
+ * - compression ratio against raw float3 + color32 data
+ * - subscriber decode time per point cloud
+ *
+ * Also checks codec round trip error against quantization step.
+ *
+ * Usage: unhvd-cloud-benchmark [sets]
+ */
+
+#include "unhvd_test_common.h"
+#include "../unhvd_cloud_codec.h"
+
+#include <atomic>
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+const int WIDTH = 848, HEIGHT = 480;
+const int TEMPLATES = 4;
+const float QUANTIZATION = 0.001f;
+
+struct test_source
+{
+	AVFrame *depth[TEMPLATES];
+	AVFrame *texture;
+	AVFrame *lent[2];
+	int64_t pts;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+	av_frame_ref(s->lent[0], s->depth[s->pts % TEMPLATES]);
+	av_frame_ref(s->lent[1], s->texture);
+	s->lent[0]->pts = s->lent[1]->pts = s->pts++;
+
+	frames[0] = s->lent[0];
+	frames[1] = s->lent[1];
+	frames[2] = NULL;
+
+	//leave publisher thread time to send, replaced messages are not benchmarked
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	return NHVD_OK;
+}
+
+struct test_subscriber
+{
+	int fd;
+	std::atomic<int> messages;
+	uint64_t bytes;
+	uint64_t raw_bytes;
+	uint64_t decode_us;
+	thread reader;
+};
+
+static void test_subscriber_read(test_subscriber *s)
+{
+	unhvd_cloud_codec *codec = unhvd_cloud_codec_init(0.0f);
+	UNHVD_CHECK(codec != NULL);
+
+	vector<uint8_t> message;
+	vector<float3> points(WIDTH * HEIGHT);
+	vector<color32> colors(WIDTH * HEIGHT);
+	unhvd_point_cloud cloud = {points.data(), colors.data(), (int)points.size(), 0};
+	unhvd_cloud_header header;
+
+	message.resize(UNHVD_CLOUD_HEADER_SIZE);
+
+	while(unhvd_test_read_all(s->fd, message.data(), UNHVD_CLOUD_HEADER_SIZE))
+	{
+		UNHVD_CHECK(unhvd_cloud_parse_header(message.data(), &header) == UNHVD_OK);
+
+		message.resize(UNHVD_CLOUD_HEADER_SIZE + header.payload_size);
+
+		if(!unhvd_test_read_all(s->fd, message.data() + UNHVD_CLOUD_HEADER_SIZE, header.payload_size))
+			break;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		//every message decodes on its own, no matter which were missed
+		UNHVD_CHECK(unhvd_cloud_decode(codec, message.data(), message.size(), &cloud) == UNHVD_OK);
+
+		s->decode_us += std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		UNHVD_CHECK(cloud.used == header.points && cloud.used > 0);
+		UNHVD_CHECK(colors[0] == 0xFF336699);
+
+		s->bytes += message.size();
+		s->raw_bytes += (uint64_t)cloud.used * (sizeof(float3) + sizeof(color32));
+		++s->messages;
+
+		message.resize(UNHVD_CLOUD_HEADER_SIZE);
+	}
+
+	unhvd_cloud_codec_close(codec);
+}
+
+// encode and decode directly, positions within half of quantization step
+static void test_round_trip()
+{
+	const int POINTS = 10000;
+
+	vector<float3> in(POINTS), out(POINTS);
+	vector<color32> in_colors(POINTS), out_colors(POINTS);
+
+	for(int i=0;i<POINTS;++i)
+	{
+		in[i][0] = -2.0f + 0.0004f * i;
+		in[i][1] = sinf(0.01f * i);
+		in[i][2] = 1.0f + 0.0001f * (i % 97);
+		in_colors[i] = 0xFF000000 | (i * 2654435761u >> 8);
+	}
+
+	unhvd_point_cloud pc = {in.data(), in_colors.data(), POINTS, POINTS};
+	unhvd_point_cloud decoded = {out.data(), out_colors.data(), POINTS, 0};
+
+	unhvd_cloud_codec *encoder = unhvd_cloud_codec_init(QUANTIZATION);
+	unhvd_cloud_codec *decoder = unhvd_cloud_codec_init(0.0f);
+	vector<uint8_t> message(unhvd_cloud_encode_bound(POINTS));
+
+	const int size = unhvd_cloud_encode(encoder, &pc, 42, message.data(), message.size());
+	UNHVD_CHECK(size > UNHVD_CLOUD_HEADER_SIZE);
+	UNHVD_CHECK(unhvd_cloud_decode(decoder, message.data(), size, &decoded) == UNHVD_OK);
+	UNHVD_CHECK(decoded.used == POINTS);
+
+	for(int i=0;i<POINTS;++i)
+	{
+		for(int j=0;j<3;++j)
+			UNHVD_CHECK(fabsf(out[i][j] - in[i][j]) <= QUANTIZATION * 0.5f + 1e-6f);
+
+		UNHVD_CHECK(out_colors[i] == in_colors[i]);
+	}
+
+	//truncated message is rejected
+	UNHVD_CHECK(unhvd_cloud_decode(decoder, message.data(), size - 1, &decoded) == UNHVD_ERROR);
+
+	unhvd_cloud_codec_close(encoder);
+	unhvd_cloud_codec_close(decoder);
+}
+
+static void test_benchmark(int sets)
+{
+	const uint16_t port = unhvd_test_port();
+
+	test_source source;
+
+	for(int t=0;t<TEMPLATES;++t)
+	{
+		source.depth[t] = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+		unhvd_test_fill_scene(source.depth[t], t + 1);
+	}
+
+	source.texture = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_texture(source.texture, 0xFF336699);
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = WIDTH / 2;
+	depth.ppy = HEIGHT / 2;
+	depth.fx = depth.fy = 420.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	unhvd_publish_config publish;
+	memset(&publish, 0, sizeof(publish));
+	publish.ip = "127.0.0.1";
+	publish.port = port;
+	publish.quantization = QUANTIZATION;
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sync = 1;
+	pipeline.publish = &publish;
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 2, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	test_subscriber subscriber;
+	subscriber.fd = unhvd_test_connect(port);
+	subscriber.messages = 0;
+	subscriber.bytes = subscriber.raw_bytes = subscriber.decode_us = 0;
+	subscriber.reader = thread(test_subscriber_read, &subscriber);
+
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [sets](const unhvd_stats &s){ return s.published >= (uint64_t)sets; }, 60000));
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+
+	unhvd_close(u); //disconnects subscriber
+	subscriber.reader.join();
+	close(subscriber.fd);
+
+	UNHVD_CHECK(subscriber.messages > 0);
+	UNHVD_CHECK(stats.publish_bytes > 0);
+
+	printf("point clouds: %llu published, %llu replaced before sending, %d received\n",
+		(unsigned long long)stats.published, (unsigned long long)stats.publish_dropped, subscriber.messages.load());
+	printf("points per cloud: %.0f\n", stats.publish_raw_bytes / (double)(sizeof(float3) + sizeof(color32)) / stats.published);
+	printf("encode time per cloud: %.1f us average, %d us max\n",
+		stats.publish_encode_us / (double)stats.published, stats.publish_encode_max_us);
+	printf("compression ratio against raw: %.2f (%.1f bytes per point)\n",
+		stats.publish_raw_bytes / (double)stats.publish_bytes,
+		stats.publish_bytes / (stats.publish_raw_bytes / (double)(sizeof(float3) + sizeof(color32))));
+	printf("subscriber: ratio %.2f, decode time per cloud %.1f us average\n",
+		subscriber.raw_bytes / (double)subscriber.bytes, subscriber.decode_us / (double)subscriber.messages);
+
+	for(int t=0;t<TEMPLATES;++t)
+		av_frame_free(&source.depth[t]);
+
+	av_frame_free(&source.texture);
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+}
+
+int main(int argc, char **argv)
+{
+	const int sets = argc > 1 ? atoi(argv[1]) : 120;
+
+	test_round_trip();
+	test_benchmark(sets > 0 ? sets : 120);
+
+	return 0;
+}
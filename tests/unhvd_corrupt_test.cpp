@@ -0,0 +1,374 @@
+/*
+ * UNHVD loss injection test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Feeds depth + texture sets with injected losses:
+ * - depth flagged corrupt by decoder (concealed with garbage depth)
+ * - texture with decode errors
+ * - texture lost entirely (set never matched)
+ *
+ * and checks each corrupt policy (publish, reuse, drop) with its counters,
+ * frame info corrupt flags and point clouds seen by callback and consumer.
+ *
+ * Then streams through sender with configurable packet loss (whole network
+ * frames and single subframes) in front of decoder that flags frames
+ * corrupt from loss until keyframe. Checks loss and keyframe request counters.
+ *
+ * Usage: unhvd-corrupt-test [loss percent]
+ */
+
+#include "unhvd_test_common.h"
+
+#include <atomic>
+#include <algorithm>
+#include <math.h>
+
+const int WIDTH = 16, HEIGHT = 8;
+const int FRAMES = 64; //network frames fed
+const int LOSSY_FRAMES = 600, GOP = 30; //network frames fed by lossy sender, keyframe every GOP
+const uint16_t GOOD_DEPTH = 10000, BAD_DEPTH = 30000; //1 m and 3 m
+
+// losses repeat every 10 network frames
+enum test_loss
+{
+	TEST_NONE,
+	TEST_DEPTH_CORRUPT, //frame 3
+	TEST_TEXTURE_LOST, //frame 5
+	TEST_TEXTURE_ERRORS //frame 7
+};
+
+static test_loss test_loss_of(int64_t frame)
+{
+	switch(frame % 10)
+	{
+		case 3: return TEST_DEPTH_CORRUPT;
+		case 5: return TEST_TEXTURE_LOST;
+		case 7: return TEST_TEXTURE_ERRORS;
+	}
+	return TEST_NONE;
+}
+
+struct test_source
+{
+	AVFrame *good_depth;
+	AVFrame *bad_depth;
+	AVFrame *texture;
+	AVFrame *lent[2];
+	int64_t pts;
+	std::atomic<bool> finished;
+
+	//callback, decoding thread only (read after close)
+	int callbacks;
+	int no_point_cloud;
+	int corrupt_info;
+	int bad_point_clouds;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	if(s->pts >= FRAMES)
+	{
+		s->finished = true;
+		return unhvd_test_timeout(frames);
+	}
+
+	const test_loss loss = test_loss_of(s->pts);
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+
+	av_frame_ref(s->lent[0], loss == TEST_DEPTH_CORRUPT ? s->bad_depth : s->good_depth);
+	av_frame_ref(s->lent[1], s->texture);
+	s->lent[0]->pts = s->lent[1]->pts = s->pts++;
+
+	if(loss == TEST_DEPTH_CORRUPT)
+		s->lent[0]->flags |= AV_FRAME_FLAG_CORRUPT;
+	if(loss == TEST_TEXTURE_ERRORS)
+		s->lent[1]->decode_error_flags = 1;
+
+	frames[0] = s->lent[0];
+	frames[1] = loss == TEST_TEXTURE_LOST ? NULL : s->lent[1];
+	frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+static void test_callback(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user)
+{
+	test_source *s = (test_source*)user;
+
+	++s->callbacks;
+
+	if(info[0].corrupt || info[1].corrupt)
+		++s->corrupt_info;
+
+	if(pc == NULL)
+		++s->no_point_cloud;
+	else if(pc->used && fabsf(pc->data[0][2] - BAD_DEPTH * 0.0001f) < 0.01f)
+		++s->bad_point_clouds;
+}
+
+static void test_policy(int policy)
+{
+	test_source source;
+	source.good_depth = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+	source.bad_depth = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+	source.texture = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_depth(source.good_depth, GOOD_DEPTH);
+	unhvd_test_fill_depth(source.bad_depth, BAD_DEPTH);
+	unhvd_test_fill_texture(source.texture, 0xFF808080);
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+	source.finished = false;
+	source.callbacks = source.no_point_cloud = source.corrupt_info = source.bad_point_clouds = 0;
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = WIDTH / 2;
+	depth.ppy = HEIGHT / 2;
+	depth.fx = depth.fy = 16.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sync = 1;
+	pipeline.callback = test_callback;
+	pipeline.callback_user = &source;
+	pipeline.corrupt_policy = policy;
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 2, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	while(!source.finished)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	//per 10 network frames: 2 corrupt sets, texture of 1 lost (its depth replaced by the next)
+	//the last 4 frames (60-63) have corrupt depth at 63, 64 frames give 58 matched sets
+	const int matched = 58, corrupt = 13, lost = 6;
+
+	//every matched set is either published or dropped as corrupt
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [](const unhvd_stats &s){ return s.sets + s.corrupt_sets_dropped >= 58; }));
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+
+	//consumer gets the last published set and the last unprojected point cloud
+	unhvd_frame frame[2];
+	unhvd_frame_info info[2];
+	unhvd_point_cloud pc;
+
+	UNHVD_CHECK(unhvd_get_begin(u, frame, &pc) == UNHVD_OK);
+	UNHVD_CHECK(unhvd_get_frame_info(u, info) == UNHVD_OK);
+
+	const int64_t last_pts = info[0].pts;
+	const float last_z = pc.used ? pc.data[0][2] : 0.0f;
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	unhvd_close(u);
+
+	printf("policy %d: %llu sets, %llu dropped, %llu corrupt frames, %llu reused, %llu corrupt dropped\n", policy,
+		(unsigned long long)stats.sets, (unsigned long long)stats.dropped, (unsigned long long)stats.corrupt_frames,
+		(unsigned long long)stats.corrupt_sets_reused, (unsigned long long)stats.corrupt_sets_dropped);
+
+	UNHVD_CHECK(stats.dropped == (uint64_t)lost);
+	UNHVD_CHECK(stats.corrupt_frames == (uint64_t)corrupt);
+
+	if(policy == UNHVD_CORRUPT_PUBLISH)
+	{	//concealed garbage is unprojected and published
+		UNHVD_CHECK(stats.sets == (uint64_t)matched);
+		UNHVD_CHECK(stats.corrupt_sets_reused == 0 && stats.corrupt_sets_dropped == 0);
+		UNHVD_CHECK(source.callbacks == matched && source.corrupt_info == corrupt);
+		UNHVD_CHECK(source.no_point_cloud == 0 && source.bad_point_clouds == 7);
+		UNHVD_CHECK(last_pts == FRAMES - 1 && fabsf(last_z - BAD_DEPTH * 0.0001f) < 0.01f);
+	}
+	else if(policy == UNHVD_CORRUPT_REUSE)
+	{	//frames are published, point cloud stays the last good one
+		UNHVD_CHECK(stats.sets == (uint64_t)matched);
+		UNHVD_CHECK(stats.corrupt_sets_reused == (uint64_t)corrupt && stats.corrupt_sets_dropped == 0);
+		UNHVD_CHECK(source.callbacks == matched && source.corrupt_info == corrupt);
+		UNHVD_CHECK(source.no_point_cloud == corrupt && source.bad_point_clouds == 0);
+		UNHVD_CHECK(last_pts == FRAMES - 1 && fabsf(last_z - GOOD_DEPTH * 0.0001f) < 0.01f);
+	}
+	else
+	{	//corrupt sets are not published at all
+		UNHVD_CHECK(stats.sets == (uint64_t)(matched - corrupt));
+		UNHVD_CHECK(stats.corrupt_sets_reused == 0 && stats.corrupt_sets_dropped == (uint64_t)corrupt);
+		UNHVD_CHECK(source.callbacks == matched - corrupt && source.corrupt_info == 0);
+		UNHVD_CHECK(source.no_point_cloud == 0 && source.bad_point_clouds == 0);
+		UNHVD_CHECK(last_pts == FRAMES - 2 && fabsf(last_z - GOOD_DEPTH * 0.0001f) < 0.01f);
+	}
+
+	av_frame_free(&source.good_depth);
+	av_frame_free(&source.bad_depth);
+	av_frame_free(&source.texture);
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+}
+
+// sender losing packets in front of decoder with error concealment
+struct test_lossy_source
+{
+	AVFrame *frame[2]; //depth and texture
+	AVFrame *lent[2];
+	int64_t pts; //next network frame
+	int loss_percent;
+	uint32_t random;
+	bool broken[2]; //decoder lost references, outputs corrupt frames until keyframe
+	std::atomic<bool> finished;
+
+	//expected statistics, decoding thread only (read after finished)
+	int lost_frames;
+	int lost_subframes;
+	int keyframe_requests;
+	int corrupt_frames;
+};
+
+// deterministic linear congruential generator
+static int test_random(test_lossy_source *s, int n)
+{
+	s->random = s->random * 1103515245u + 12345u;
+	return (s->random >> 16) % n;
+}
+
+static void test_lose(test_lossy_source *s, int decoder)
+{
+	if(!s->broken[decoder])
+		++s->keyframe_requests;
+
+	s->broken[decoder] = true;
+}
+
+static int test_lossy_source_receive(AVFrame *frames[], void *user)
+{
+	test_lossy_source *s = (test_lossy_source*)user;
+
+	if(s->pts >= LOSSY_FRAMES)
+	{
+		s->finished = true;
+		return unhvd_test_timeout(frames);
+	}
+
+	//whole network frames are lost after the first two (frame interval is known)
+	//but not the last one (loss is found from the next frame timestamp)
+	while(s->pts >= 2 && s->pts < LOSSY_FRAMES - 1 && test_random(s, 100) < s->loss_percent)
+	{
+		++s->lost_frames;
+		test_lose(s, 0);
+		test_lose(s, 1);
+		++s->pts;
+	}
+
+	const int64_t pts = s->pts++;
+	const bool key = pts % GOP == 0;
+	//subframe of depth or texture lost (both is lost network frame)
+	const int r = test_random(s, 100);
+	const int lost = r < s->loss_percent ? 0 : r < 2 * s->loss_percent ? 1 : -1;
+
+	for(int i=0;i<2;++i)
+	{
+		frames[i] = NULL;
+
+		if(i == lost)
+		{
+			++s->lost_subframes;
+			test_lose(s, i);
+			continue;
+		}
+
+		if(key)
+			s->broken[i] = false;
+
+		av_frame_unref(s->lent[i]);
+		av_frame_ref(s->lent[i], s->frame[i]);
+		s->lent[i]->pts = pts;
+		unhvd_test_set_key(s->lent[i], key);
+
+		if(s->broken[i])
+		{
+			s->lent[i]->flags |= AV_FRAME_FLAG_CORRUPT;
+			++s->corrupt_frames;
+		}
+
+		frames[i] = s->lent[i];
+	}
+
+	frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+static void test_lossy_sender(int loss_percent)
+{
+	test_lossy_source source;
+	source.frame[0] = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+	source.frame[1] = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_depth(source.frame[0], GOOD_DEPTH);
+	unhvd_test_fill_texture(source.frame[1], 0xFF808080);
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+	source.loss_percent = loss_percent;
+	source.random = 2020;
+	source.broken[0] = source.broken[1] = false;
+	source.finished = false;
+	source.lost_frames = source.lost_subframes = source.keyframe_requests = source.corrupt_frames = 0;
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+
+	unhvd *u = unhvd_test_init(test_lossy_source_receive, &source, 2, NULL, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	while(!source.finished)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	//statistics are committed when session ends with timeout, mismatch is reported below
+	unhvd_test_wait_stats(u, [&source](const unhvd_stats &s){ return s.lost_frames == (uint64_t)source.lost_frames &&
+		s.lost_subframes == (uint64_t)source.lost_subframes && s.keyframe_requests == (uint64_t)source.keyframe_requests; });
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	unhvd_close(u);
+
+	printf("loss %d%%: %llu lost frames, %llu lost subframes, %llu keyframe requests, %d us max wait, %llu corrupt frames\n",
+		loss_percent, (unsigned long long)stats.lost_frames, (unsigned long long)stats.lost_subframes,
+		(unsigned long long)stats.keyframe_requests, stats.keyframe_wait_max_us, (unsigned long long)stats.corrupt_frames);
+
+	UNHVD_CHECK(stats.lost_frames == (uint64_t)source.lost_frames);
+	UNHVD_CHECK(stats.lost_subframes == (uint64_t)source.lost_subframes);
+	UNHVD_CHECK(stats.keyframe_requests == (uint64_t)source.keyframe_requests);
+	UNHVD_CHECK(stats.keyframe_wait_us <= stats.keyframe_wait_max_us);
+	UNHVD_CHECK(loss_percent == 0 || (source.lost_frames > 0 && source.lost_subframes > 0 && source.corrupt_frames > 0));
+
+	av_frame_free(&source.frame[0]);
+	av_frame_free(&source.frame[1]);
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+}
+
+int main(int argc, char **argv)
+{
+	const int loss_percent = argc > 1 ? atoi(argv[1]) : 5;
+
+	test_policy(UNHVD_CORRUPT_PUBLISH);
+	test_policy(UNHVD_CORRUPT_REUSE);
+	test_policy(UNHVD_CORRUPT_DROP);
+
+	//at most a third of network frames is lost (whole or one of subframes)
+	test_lossy_sender(loss_percent < 0 ? 0 : std::min(loss_percent, 33));
+
+	printf("unhvd corrupt test passed\n");
+	return 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * UNHVD depth unprojection configuration test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Unprojects synthetic flat depth frame and checks:
+ * - region of interest (unprojected pixels and their coordinates)
+ * - culling box, including partially specified (unbounded axes)
+ * - runtime reconfiguration with unhvd_set_depth_config
+ * - point cloud summary with and without culling
+ * - the same points with and without summary and culling (including zero margins)
+ * - levels of detail
+ * - invalid configuration rejection
+ */
+
+#include "unhvd_test_common.h"
+
+#include <atomic>
+#include <vector>
+#include <math.h>
+
+const int WIDTH = 64, HEIGHT = 48;
+const uint16_t DEPTH = 20000; //2 m with 0.0001 depth unit
+
+// references the same depth frame with increasing pts
+struct test_source
+{
+	AVFrame *depth;
+	AVFrame *lent;
+	std::atomic<int64_t> pts;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	av_frame_unref(s->lent);
+	av_frame_ref(s->lent, s->depth);
+	s->lent->pts = s->pts++;
+
+	frames[0] = s->lent;
+	frames[1] = frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+// pixel (x, y) is unprojected to ((x - 32) / 16, (y - 24) / 16, 2)
+static unhvd_depth_config test_depth_config()
+{
+	unhvd_depth_config dc;
+	memset(&dc, 0, sizeof(dc));
+	dc.ppx = WIDTH / 2;
+	dc.ppy = HEIGHT / 2;
+	dc.fx = dc.fy = 32.0f;
+	dc.depth_unit = 0.0001f;
+	dc.min_margin = 0.1f;
+	dc.max_margin = 0.01f; //below the top of encoded depth range
+
+	return dc;
+}
+
+static unhvd *test_init(test_source *source, const unhvd_depth_ext_config *ext, const unhvd_depth_config *depth_config = NULL)
+{
+	source->depth = unhvd_test_frame(AV_PIX_FMT_P016LE, WIDTH, HEIGHT, 0);
+	source->lent = av_frame_alloc();
+	source->pts = 0;
+
+	//flat frame for configuration tests, scene with invalid pixels otherwise
+	if(depth_config == NULL)
+		unhvd_test_fill_depth(source->depth, DEPTH);
+	else
+		unhvd_test_fill_scene(source->depth, 2020);
+
+	unhvd_depth_config dc = depth_config ? *depth_config : test_depth_config();
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.depth_ext = ext;
+
+	return unhvd_test_init(test_source_receive, source, 1, &dc, &pipeline);
+}
+
+static void test_close(unhvd *u, test_source *source)
+{
+	unhvd_close(u);
+	av_frame_free(&source->depth);
+	av_frame_free(&source->lent);
+}
+
+// get point cloud of frame with pts at least min_pts, returns with the mutex held
+static void test_get(unhvd *u, int64_t min_pts, unhvd_point_cloud *pc)
+{
+	unhvd_frame frame;
+	unhvd_frame_info info;
+
+	while(true)
+	{
+		UNHVD_CHECK(unhvd_wait_begin(u, &frame, pc, 5000) == UNHVD_OK);
+		UNHVD_CHECK(unhvd_get_frame_info(u, &info) == UNHVD_OK);
+
+		if(info.pts >= min_pts)
+			return;
+
+		UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	}
+}
+
+static bool test_near(float a, float b)
+{
+	return fabsf(a - b) < 1e-4f;
+}
+
+// number of pixels with |(x - 32) / 16| <= half_size
+static int test_columns(float half_size)
+{
+	int n = 0;
+
+	for(int x=0;x<WIDTH;++x)
+		n += fabsf((x - WIDTH / 2) / 16.0f) <= half_size;
+
+	return n;
+}
+
+static void test_no_culling()
+{
+	test_source source;
+	unhvd *u = test_init(&source, NULL);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(test_near(pc.data[0][0], -2.0f) && test_near(pc.data[0][1], -1.5f) && test_near(pc.data[0][2], 2.0f));
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	test_close(u, &source);
+}
+
+static void test_roi()
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.roi_x = 8;
+	ext.roi_y = 4;
+	ext.roi_width = 16;
+	ext.roi_height = 1000; //clipped to the frame
+
+	test_source source;
+	unhvd *u = test_init(&source, &ext);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+
+	UNHVD_CHECK(pc.used == 16 * (HEIGHT - 4));
+	//the first point is pixel (8, 4) in frame coordinates
+	UNHVD_CHECK(test_near(pc.data[0][0], -1.5f) && test_near(pc.data[0][1], -1.25f));
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	test_close(u, &source);
+}
+
+// 0 half size leaves the axis unbounded
+static void test_partial_box()
+{
+	//slab around z, unbounded in x and y, all points are kept
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.box_center[2] = 2.0f;
+	ext.box_half_size[2] = 0.5f;
+
+	test_source source;
+	unhvd *u = test_init(&source, &ext);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//slab along x at runtime, unbounded in y and z
+	unhvd_depth_config dc = test_depth_config();
+	memset(&ext, 0, sizeof(ext));
+	ext.box_half_size[0] = 1.0f;
+
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, &ext) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+
+	UNHVD_CHECK(pc.used == test_columns(1.0f) * HEIGHT);
+
+	for(int i=0;i<pc.used;++i)
+		UNHVD_CHECK(fabsf(pc.data[i][0]) <= 1.0f);
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//slab not containing the plane culls everything
+	ext.box_half_size[0] = 0.0f;
+	ext.box_center[2] = 5.0f;
+	ext.box_half_size[2] = 1.0f;
+
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, &ext) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+	UNHVD_CHECK(pc.used == 0);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//NULL extension restores whole frame without culling
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, NULL) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	test_close(u, &source);
+}
+
+// oriented box, rotation by 90 degrees around z swaps x and y extents
+static void test_rotated_box()
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.box_half_size[1] = 1.0f;
+	const float rotation[9] = {0, -1, 0, 1, 0, 0, 0, 0, 1};
+	memcpy(ext.box_rotation, rotation, sizeof(rotation));
+
+	test_source source;
+	unhvd *u = test_init(&source, &ext);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+
+	//box y axis is world x axis
+	UNHVD_CHECK(pc.used == test_columns(1.0f) * HEIGHT);
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	test_close(u, &source);
+}
+
+// summary reduced while unprojecting, with and without culling box
+static void test_summary()
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.summary = 1;
+	ext.histogram_max = 4.0f; //16 bins per meter, the plane is in bin 32
+
+	test_source source;
+	unhvd *u = test_init(&source, &ext);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	unhvd_point_cloud_summary summary;
+	test_get(u, 0, &pc);
+
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 0, &summary) == UNHVD_OK);
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(test_near(summary.min[0], -2.0f) && test_near(summary.max[0], 1.9375f));
+	UNHVD_CHECK(test_near(summary.min[1], -1.5f) && test_near(summary.max[1], 1.4375f));
+	UNHVD_CHECK(test_near(summary.min[2], 2.0f) && test_near(summary.max[2], 2.0f));
+	UNHVD_CHECK(test_near(summary.centroid[0], -0.03125f) && test_near(summary.centroid[1], -0.03125f));
+	UNHVD_CHECK(test_near(summary.nearest, 2.0f));
+	UNHVD_CHECK(summary.histogram[32] == (uint32_t)pc.used && test_near(summary.histogram_max, 4.0f));
+
+	//levels of detail were not configured
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 1, &summary) == UNHVD_ERROR);
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, UNHVD_MAX_LOD_LEVELS, &summary) == UNHVD_ERROR);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//summary of points kept by slab along x
+	unhvd_depth_config dc = test_depth_config();
+	ext.box_half_size[0] = 1.0f;
+
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, &ext) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 0, &summary) == UNHVD_OK);
+	UNHVD_CHECK(pc.used == test_columns(1.0f) * HEIGHT);
+	UNHVD_CHECK(test_near(summary.min[0], -1.0f) && test_near(summary.max[0], 1.0f));
+	UNHVD_CHECK(test_near(summary.centroid[0], 0.0f) && test_near(summary.nearest, 2.0f));
+	UNHVD_CHECK(summary.histogram[32] == (uint32_t)pc.used);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//without summary requested there is nothing to get
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, NULL) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 0, &summary) == UNHVD_ERROR);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	test_close(u, &source);
+}
+
+// summary and culling box containing everything keep unprojected points as they are
+// (margins, axes and default color of unprojector), bands don't change points order
+static void test_unchanged(float min_margin, float max_margin)
+{
+	unhvd_depth_config dc = test_depth_config();
+	dc.min_margin = min_margin;
+	dc.max_margin = max_margin;
+
+	test_source source;
+	unhvd *u = test_init(&source, NULL, &dc);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+
+	const int used = pc.used;
+	const std::vector<float> data(&pc.data[0][0], &pc.data[0][0] + 3 * used);
+	const std::vector<uint32_t> colors(pc.colors, pc.colors + used);
+
+	UNHVD_CHECK(used > 0 && used < WIDTH * HEIGHT);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	unhvd_depth_ext_config ext;
+
+	for(int culling=0;culling<2;++culling)
+	{
+		memset(&ext, 0, sizeof(ext));
+		ext.summary = 1;
+		ext.histogram_max = 8.0f;
+
+		for(int k=0;culling && k<3;++k)
+			ext.box_half_size[k] = 100.0f;
+
+		UNHVD_CHECK(unhvd_set_depth_config(u, &dc, &ext) == UNHVD_OK);
+		test_get(u, source.pts, &pc);
+
+		UNHVD_CHECK(pc.used == used);
+		UNHVD_CHECK(memcmp(pc.data, data.data(), data.size() * sizeof(float)) == 0);
+		UNHVD_CHECK(memcmp(pc.colors, colors.data(), colors.size() * sizeof(uint32_t)) == 0);
+
+		unhvd_point_cloud_summary summary;
+		UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 0, &summary) == UNHVD_OK);
+		UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+		uint32_t histogram = 0;
+		for(int b=0;b<UNHVD_HISTOGRAM_BINS;++b)
+			histogram += summary.histogram[b];
+
+		UNHVD_CHECK(histogram == (uint32_t)used);
+	}
+
+	test_close(u, &source);
+}
+
+// get point cloud level of the next set, returns with the mutex held
+static void test_get_level(unhvd *u, int level, unhvd_point_cloud *pc)
+{
+	while(unhvd_get_point_cloud_level_begin(u, level, pc) != UNHVD_OK)
+	{
+		UNHVD_CHECK(unhvd_get_point_cloud_end(u) == UNHVD_OK);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// decimated levels have quarter of points each, level not configured is empty
+static void test_levels()
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.lod_levels = UNHVD_MAX_LOD_LEVELS - 1;
+	ext.lod_method = UNHVD_LOD_MEDIAN;
+
+	test_source source;
+	unhvd *u = test_init(&source, &ext);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_point_cloud pc;
+	test_get(u, 0, &pc);
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	for(int l=1;l<UNHVD_MAX_LOD_LEVELS;++l)
+	{
+		test_get_level(u, l, &pc);
+		UNHVD_CHECK(pc.used == (WIDTH >> l) * (HEIGHT >> l));
+		UNHVD_CHECK(test_near(pc.data[0][2], 2.0f));
+		UNHVD_CHECK(unhvd_get_point_cloud_end(u) == UNHVD_OK);
+	}
+
+	UNHVD_CHECK(unhvd_get_point_cloud_level_begin(u, UNHVD_MAX_LOD_LEVELS, &pc) == UNHVD_ERROR);
+	UNHVD_CHECK(unhvd_get_point_cloud_end(u) == UNHVD_OK);
+
+	//without levels at runtime
+	unhvd_depth_config dc = test_depth_config();
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, NULL) == UNHVD_OK);
+	test_get(u, source.pts, &pc);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	//consumers uploading whole size don't get stale level
+	test_get_level(u, 1, &pc);
+	UNHVD_CHECK(pc.used == 0 && pc.size >= (WIDTH >> 1) * (HEIGHT >> 1));
+
+	for(int i=0;i<pc.size;++i)
+		UNHVD_CHECK(pc.data[i][0] == 0.0f && pc.data[i][1] == 0.0f && pc.data[i][2] == 0.0f && pc.colors[i] == 0);
+
+	UNHVD_CHECK(unhvd_get_point_cloud_end(u) == UNHVD_OK);
+
+	test_close(u, &source);
+}
+
+static void test_invalid()
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.box_half_size[1] = -1.0f;
+
+	test_source source;
+	UNHVD_CHECK(test_init(&source, &ext) == NULL);
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+
+	memset(&ext, 0, sizeof(ext));
+	ext.lod_levels = UNHVD_MAX_LOD_LEVELS;
+
+	UNHVD_CHECK(test_init(&source, &ext) == NULL);
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+
+	memset(&ext, 0, sizeof(ext));
+	ext.roi_width = -1;
+
+	UNHVD_CHECK(test_init(&source, &ext) == NULL);
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+
+	//rejected at runtime, previous configuration is kept
+	unhvd *u = test_init(&source, NULL);
+	UNHVD_CHECK(u != NULL);
+
+	unhvd_depth_config dc = test_depth_config();
+	UNHVD_CHECK(unhvd_set_depth_config(u, &dc, &ext) == UNHVD_ERROR);
+
+	unhvd_point_cloud pc;
+	test_get(u, source.pts, &pc);
+	UNHVD_CHECK(pc.used == WIDTH * HEIGHT);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	test_close(u, &source);
+}
+
+int main(int argc, char **argv)
+{
+	test_no_culling();
+	test_roi();
+	test_partial_box();
+	test_rotated_box();
+	test_summary();
+	test_unchanged(0.1f, 0.01f);
+	test_unchanged(0.0f, 0.0f);
+	test_levels();
+	test_invalid();
+
+	printf("unhvd depth test passed\n");
+	return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * UNHVD dmabuf export test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Feeds synthetic frames and checks exported frame descriptions:
+ * - DRM PRIME layers are flattened to fd, offset and pitch of planes
+ * - software frames fall back to system memory data with UNHVD_EXPORT_DMABUF
+ * - software frames are exported through memfd with UNHVD_EXPORT_MEMFD
+ */
+
+#include "unhvd_test_common.h"
+
+extern "C" {
+#include <libavutil/hwcontext_drm.h>
+}
+
+#include <atomic>
+#include <sys/mman.h>
+
+// feeds frames one by one (ownership passed to source), then timeouts
+struct test_source
+{
+	AVFrame *frames[4];
+	int count;
+	std::atomic<int> next;
+	std::atomic<int> allowed; //frames that may be fed so far
+	AVFrame *lent; //the library moves reference out of it
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	if(s->next >= s->count || s->next >= s->allowed)
+		return unhvd_test_timeout(frames);
+
+	av_frame_unref(s->lent);
+	av_frame_move_ref(s->lent, s->frames[s->next]);
+	av_frame_free(&s->frames[s->next]);
+	++s->next;
+
+	frames[0] = s->lent;
+	return NHVD_OK;
+}
+
+static unhvd *test_init(test_source *source, int export_mode)
+{
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.export_dmabuf[0] = export_mode;
+
+	source->next = 0;
+	source->lent = av_frame_alloc();
+
+	unhvd *u = unhvd_test_init(test_source_receive, source, 1, NULL, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	return u;
+}
+
+static void test_close(unhvd *u, test_source *source)
+{
+	unhvd_close(u);
+	av_frame_free(&source->lent);
+
+	for(int i=source->next;i<source->count;++i)
+		av_frame_free(&source->frames[i]);
+}
+
+// retrieve the next set, returns with the mutex held (call unhvd_get_end)
+static void test_get(unhvd *u, unhvd_frame *frame, unhvd_frame_info *info)
+{
+	UNHVD_CHECK(unhvd_wait_begin(u, frame, NULL, 5000) == UNHVD_OK);
+	UNHVD_CHECK(unhvd_get_frame_info(u, info) == UNHVD_OK);
+}
+
+static void test_descriptor_free(void *opaque, uint8_t *data)
+{}
+
+// decoder output already in DRM PRIME format (e.g. v4l2m2m), layers are flattened
+static void test_flatten()
+{
+	static AVDRMFrameDescriptor desc;
+	memset(&desc, 0, sizeof(desc));
+
+	desc.nb_objects = 2;
+	desc.objects[0].fd = 100;
+	desc.objects[0].size = 1 << 20;
+	desc.objects[0].format_modifier = 0x0100000000000001ULL;
+	desc.objects[1].fd = 101;
+	desc.objects[1].size = 1 << 19;
+	desc.objects[1].format_modifier = 0;
+
+	//3 layers with 1 + 1 + 3 planes, only UNHVD_MAX_DMABUF_PLANES are returned
+	const int planes[3] = {1, 1, 3};
+	desc.nb_layers = 3;
+
+	for(int l=0;l<3;++l)
+	{
+		desc.layers[l].format = 0x20203852 + l; //"R8  " + l
+		desc.layers[l].nb_planes = planes[l];
+
+		for(int p=0;p<planes[l];++p)
+		{
+			desc.layers[l].planes[p].object_index = (l + p) % 2;
+			desc.layers[l].planes[p].offset = 4096 * (10 * l + p);
+			desc.layers[l].planes[p].pitch = 1024 + 64 * (10 * l + p);
+		}
+	}
+
+	AVFrame *frame = av_frame_alloc();
+	frame->format = AV_PIX_FMT_DRM_PRIME;
+	frame->width = 640;
+	frame->height = 480;
+	frame->pts = 7;
+	frame->data[0] = (uint8_t*)&desc;
+	frame->buf[0] = av_buffer_create((uint8_t*)&desc, sizeof(desc), test_descriptor_free, NULL, 0);
+
+	test_source source;
+	source.frames[0] = frame;
+	source.count = source.allowed = 1;
+
+	unhvd *u = test_init(&source, UNHVD_EXPORT_DMABUF);
+	unhvd_frame f;
+	unhvd_frame_info info;
+
+	test_get(u, &f, &info);
+
+	UNHVD_CHECK(f.width == 640 && f.height == 480 && f.format == AV_PIX_FMT_DRM_PRIME);
+	UNHVD_CHECK(f.data[0] == NULL && f.linesize[0] == 0);
+	UNHVD_CHECK(info.fresh && !info.corrupt && info.pts == 7);
+
+	const unhvd_dmabuf *d = &info.dmabuf;
+
+	UNHVD_CHECK(d->objects == 2);
+	UNHVD_CHECK(d->fd[0] == 100 && d->size[0] == 1 << 20 && d->modifier[0] == 0x0100000000000001ULL);
+	UNHVD_CHECK(d->fd[1] == 101 && d->size[1] == 1 << 19 && d->modifier[1] == 0);
+
+	UNHVD_CHECK(d->planes == UNHVD_MAX_DMABUF_PLANES);
+
+	//flattened in layer order: (0,0) (1,0) (2,0) (2,1)
+	const int layer[4] = {0, 1, 2, 2}, plane[4] = {0, 0, 0, 1};
+
+	for(int i=0;i<d->planes;++i)
+	{
+		const AVDRMPlaneDescriptor *expected = &desc.layers[layer[i]].planes[plane[i]];
+
+		UNHVD_CHECK(d->format[i] == desc.layers[layer[i]].format);
+		UNHVD_CHECK(d->object[i] == expected->object_index);
+		UNHVD_CHECK(d->offset[i] == expected->offset);
+		UNHVD_CHECK(d->pitch[i] == expected->pitch);
+	}
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	UNHVD_CHECK(stats.exported == 1 && stats.export_fallbacks == 0);
+
+	test_close(u, &source);
+}
+
+// software frame can't be mapped, the frame keeps system memory data
+static void test_fallback()
+{
+	test_source source;
+	source.frames[0] = unhvd_test_frame(AV_PIX_FMT_NV12, 64, 48, 1);
+	source.count = source.allowed = 1;
+
+	unhvd *u = test_init(&source, UNHVD_EXPORT_DMABUF);
+	unhvd_frame f;
+	unhvd_frame_info info;
+
+	test_get(u, &f, &info);
+
+	UNHVD_CHECK(f.data[0] != NULL && f.data[1] != NULL && f.linesize[0] >= 64);
+	UNHVD_CHECK(info.fresh && info.dmabuf.objects == 0 && info.dmabuf.planes == 0);
+
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	UNHVD_CHECK(stats.exported == 0 && stats.export_fallbacks == 1);
+
+	test_close(u, &source);
+}
+
+static uint8_t test_pattern(int x, int y, int plane, int frame)
+{
+	return (uint8_t)(x + 3 * y + 7 * plane + 11 * frame);
+}
+
+// software frames copied to memfd (or udmabuf) buffers, described like hardware frames
+static void test_memfd()
+{
+	const int FRAMES = 4, WIDTH = 64, HEIGHT = 48;
+
+	test_source source;
+	source.count = FRAMES;
+	source.allowed = 0;
+
+	for(int i=0;i<FRAMES;++i)
+	{
+		AVFrame *frame = unhvd_test_frame(AV_PIX_FMT_NV12, WIDTH, HEIGHT, i);
+
+		for(int p=0;p<2;++p)
+			for(int y=0;y<(p ? HEIGHT / 2 : HEIGHT);++y)
+				for(int x=0;x<WIDTH;++x)
+					frame->data[p][y * frame->linesize[p] + x] = test_pattern(x, y, p, i);
+
+		source.frames[i] = frame;
+	}
+
+	unhvd *u = test_init(&source, UNHVD_EXPORT_MEMFD);
+
+	//each frame is retrieved, exported buffers are released and reused
+	for(int i=0;i<FRAMES;++i)
+	{
+		source.allowed = i + 1;
+
+		unhvd_frame f;
+		unhvd_frame_info info;
+
+		test_get(u, &f, &info);
+
+		const unhvd_dmabuf *d = &info.dmabuf;
+
+		UNHVD_CHECK(f.data[0] == NULL && f.format == AV_PIX_FMT_DRM_PRIME);
+		UNHVD_CHECK(f.width == WIDTH && f.height == HEIGHT && info.pts == i);
+		UNHVD_CHECK(d->objects == 1 && d->fd[0] >= 0 && d->modifier[0] == 0);
+		UNHVD_CHECK(d->planes == 2);
+		UNHVD_CHECK(d->format[0] == 0x3231564E && d->format[1] == 0x3231564E); //"NV12"
+
+		uint8_t *data = (uint8_t*)mmap(NULL, d->size[0], PROT_READ, MAP_SHARED, d->fd[0], 0);
+		UNHVD_CHECK(data != MAP_FAILED);
+
+		for(int p=0;p<2;++p)
+		{
+			UNHVD_CHECK(d->object[p] == 0 && d->pitch[p] >= WIDTH);
+			UNHVD_CHECK(d->offset[p] + (uint64_t)d->pitch[p] * (p ? HEIGHT / 2 : HEIGHT) <= d->size[0]);
+
+			for(int y=0;y<(p ? HEIGHT / 2 : HEIGHT);++y)
+				for(int x=0;x<WIDTH;++x)
+					UNHVD_CHECK(data[d->offset[p] + y * d->pitch[p] + x] == test_pattern(x, y, p, i));
+		}
+
+		munmap(data, d->size[0]);
+
+		UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	}
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	UNHVD_CHECK(stats.exported == FRAMES && stats.export_fallbacks == 0);
+
+	test_close(u, &source);
+}
+
+int main(int argc, char **argv)
+{
+	test_flatten();
+	test_fallback();
+	test_memfd();
+
+	printf("unhvd dmabuf test passed\n");
+	return 0;
+}
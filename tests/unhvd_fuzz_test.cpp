@@ -0,0 +1,298 @@
+/*
+ * UNHVD frame geometry fuzz test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Feeds depth + texture sets with pseudo-random width, height, linesize
+ * and pixel format (including empty, negative, unaligned and too small)
+ * through frame validation and unprojection with region of interest
+ * and levels of detail. Frame buffers are exactly linesize * height
+ * so out of bounds access is caught with UNHVD_SANITIZE=address.
+ *
+ * Checks that exactly malformed sets are rejected (not unprojected)
+ * and valid sets have the expected number of points.
+ *
+ * Usage: unhvd-fuzz-test [sets] [seed]
+ */
+
+#include "unhvd_test_common.h"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+const uint16_t VALID_DEPTH = 10000, INVALID_DEPTH = 500; //1 m and 5 cm (below min margin)
+const uint32_t COLOR = 0xFF102030;
+const int ROI_X = 3, ROI_Y = 2, ROI_WIDTH = 40; //whole height
+
+// malformation injected into the set (if any)
+enum test_fault
+{
+	TEST_DEPTH_WIDTH, //zero or negative
+	TEST_DEPTH_HEIGHT, //zero or negative
+	TEST_DEPTH_STRIDE, //odd or smaller than row
+	TEST_DEPTH_FORMAT, //not uint16 depth
+	TEST_TEXTURE_FORMAT, //not 32 bit color
+	TEST_TEXTURE_WIDTH, //narrower than depth
+	TEST_TEXTURE_HEIGHT, //shorter than depth
+	TEST_TEXTURE_STRIDE, //unaligned or smaller than depth row
+	TEST_FAULTS
+};
+
+// what the pipeline should do with the set
+struct test_expected
+{
+	bool valid;
+	int points;
+};
+
+struct test_source
+{
+	AVFrame *lent[2];
+	int64_t pts;
+	int sets; //to feed, then timeout
+	uint32_t random;
+	std::atomic<bool> finished;
+
+	//decoding thread only (read after finished)
+	vector<test_expected> expected;
+	int callbacks;
+	int invalid;
+};
+
+// deterministic linear congruential generator
+static int test_random(test_source *s, int n)
+{
+	s->random = s->random * 1103515245u + 12345u;
+	return (s->random >> 16) % n;
+}
+
+static bool test_valid_depth(int64_t pts, int x, int y)
+{
+	return (x * 7 + y * 13 + pts) % 3 != 0;
+}
+
+// frame with buffer of exactly linesize * height bytes (at least 1)
+static AVFrame *test_fuzz_frame(AVFrame *frame, int format, int width, int height, int linesize)
+{
+	const int size = linesize > 0 && height > 0 ? linesize * height : 1;
+	uint8_t *data = (uint8_t*)av_malloc(size);
+	UNHVD_CHECK(data != NULL);
+
+	frame->buf[0] = av_buffer_create(data, size, av_buffer_default_free, NULL, 0);
+	UNHVD_CHECK(frame->buf[0] != NULL);
+
+	frame->data[0] = data;
+	frame->linesize[0] = linesize;
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+
+	memset(data, 0xA5, size);
+
+	return frame;
+}
+
+// the same rules as unhvd_validate_frames
+static bool test_validate(const AVFrame *depth, const AVFrame *texture)
+{
+	if(depth->format != AV_PIX_FMT_P010LE && depth->format != AV_PIX_FMT_P016LE)
+		return false;
+
+	if(depth->width <= 0 || depth->height <= 0 || depth->linesize[0] < 2 * depth->width || depth->linesize[0] % 2)
+		return false;
+
+	if(texture == NULL)
+		return true;
+
+	if(texture->format != AV_PIX_FMT_RGB0 && texture->format != AV_PIX_FMT_RGBA)
+		return false;
+
+	return texture->width >= depth->width && texture->height >= depth->height &&
+		texture->linesize[0] >= 4 * depth->width && texture->linesize[0] % 4 == 0;
+}
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	if(s->pts >= s->sets)
+	{
+		s->finished = true;
+		return unhvd_test_timeout(frames);
+	}
+
+	const int64_t pts = s->pts++;
+	//about half of sets gets one malformation, the rest random valid geometry
+	const int fault = test_random(s, 2 * TEST_FAULTS);
+
+	int width = test_random(s, 70) + 1, height = test_random(s, 50) + 1;
+	int linesize = 2 * width + 2 * test_random(s, 16);
+	int format = test_random(s, 2) ? AV_PIX_FMT_P010LE : AV_PIX_FMT_P016LE;
+	bool has_texture = test_random(s, 4) != 0 || fault >= TEST_TEXTURE_FORMAT;
+
+	//texture may be larger than depth, with padded rows
+	int texture_width = width + test_random(s, 2) * 3, texture_height = height + test_random(s, 2) * 2;
+	int texture_linesize = 4 * texture_width + 4 * test_random(s, 16);
+	int texture_format = test_random(s, 2) ? AV_PIX_FMT_RGB0 : AV_PIX_FMT_RGBA;
+
+	switch(fault)
+	{
+		case TEST_DEPTH_WIDTH: width = -test_random(s, 2); linesize = 0; break;
+		case TEST_DEPTH_HEIGHT: height = -test_random(s, 2); break;
+		case TEST_DEPTH_STRIDE: linesize = 2 * width - 2 * test_random(s, 2) - 1; break;
+		case TEST_DEPTH_FORMAT: format = test_random(s, 2) ? AV_PIX_FMT_NV12 : AV_PIX_FMT_RGB0; break;
+		case TEST_TEXTURE_FORMAT: texture_format = AV_PIX_FMT_P010LE; break;
+		case TEST_TEXTURE_WIDTH: texture_width = width - 1; break;
+		case TEST_TEXTURE_HEIGHT: texture_height = height - 1; break;
+		case TEST_TEXTURE_STRIDE: texture_linesize = 4 * width - 4 * test_random(s, 2) - 2; break;
+	}
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+
+	AVFrame *depth = test_fuzz_frame(s->lent[0], format, width, height, linesize);
+	AVFrame *texture = has_texture ? test_fuzz_frame(s->lent[1], texture_format,
+		texture_width, texture_height, texture_linesize) : NULL;
+
+	test_expected expected = {test_validate(depth, texture), 0};
+	UNHVD_CHECK(expected.valid == (fault >= TEST_FAULTS));
+
+	if(expected.valid)
+	{	//fill the frames and count points in clipped region of interest
+		for(int y=0;y<height;++y)
+		{
+			uint16_t *row = (uint16_t*)(depth->data[0] + y * depth->linesize[0]);
+
+			for(int x=0;x<width;++x)
+				row[x] = test_valid_depth(pts, x, y) ? VALID_DEPTH : INVALID_DEPTH;
+		}
+
+		for(int y=0;texture && y<height;++y)
+		{
+			uint32_t *row = (uint32_t*)(texture->data[0] + y * texture->linesize[0]);
+
+			for(int x=0;x<width;++x)
+				row[x] = COLOR;
+		}
+
+		const int roi_x = min(ROI_X, width), roi_y = min(ROI_Y, height);
+		const int roi_width = min(ROI_WIDTH, width - roi_x);
+
+		for(int y=roi_y;y<height;++y)
+			for(int x=roi_x;x<roi_x + roi_width;++x)
+				expected.points += test_valid_depth(pts, x, y);
+	}
+	else
+		++s->invalid;
+
+	s->expected.push_back(expected);
+
+	depth->pts = pts;
+	if(texture)
+		texture->pts = pts;
+
+	frames[0] = depth;
+	frames[1] = texture;
+	frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+// malformed sets are published without point cloud, valid ones with all valid points
+static void test_callback(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user)
+{
+	test_source *s = (test_source*)user;
+
+	UNHVD_CHECK(info[0].fresh && info[0].pts >= 0 && info[0].pts < (int64_t)s->expected.size());
+	const test_expected &expected = s->expected[info[0].pts];
+
+	++s->callbacks;
+
+	if(!expected.valid)
+	{
+		UNHVD_CHECK(pc == NULL);
+		return;
+	}
+
+	UNHVD_CHECK(pc != NULL && pc->used == expected.points && pc->used <= pc->size);
+
+	if(pc->used)
+		UNHVD_CHECK(fabsf(pc->data[0][2] - VALID_DEPTH * 0.0001f) < 1e-4f);
+
+	if(pc->used && info[1].fresh)
+		UNHVD_CHECK(pc->colors[0] == COLOR && pc->colors[pc->used - 1] == COLOR);
+}
+
+int main(int argc, char **argv)
+{
+	const int sets = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 2000;
+	const uint32_t seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 2020;
+
+	test_source source;
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+	source.sets = sets;
+	source.random = seed;
+	source.finished = false;
+	source.expected.reserve(sets);
+	source.callbacks = source.invalid = 0;
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = 16.0f;
+	depth.ppy = 12.0f;
+	depth.fx = depth.fy = 32.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.roi_x = ROI_X;
+	ext.roi_y = ROI_Y;
+	ext.roi_width = ROI_WIDTH;
+	ext.lod_levels = 2;
+	ext.lod_method = UNHVD_LOD_MEDIAN;
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.callback = test_callback;
+	pipeline.callback_user = &source;
+	pipeline.depth_ext = &ext;
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 2, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	while(!source.finished)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [sets](const unhvd_stats &s){ return s.sets >= (uint64_t)sets; }));
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	unhvd_close(u);
+
+	printf("%llu sets, %d malformed, %llu rejected\n", (unsigned long long)stats.sets,
+		source.invalid, (unsigned long long)stats.unproject_rejected);
+
+	//every set is published, only malformed ones are not unprojected
+	UNHVD_CHECK(stats.sets == (uint64_t)sets && source.callbacks == sets);
+	UNHVD_CHECK(stats.unproject_rejected == (uint64_t)source.invalid);
+	UNHVD_CHECK(source.invalid > 0 && source.invalid < sets);
+
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+
+	printf("unhvd fuzz test passed\n");
+	return 0;
+}
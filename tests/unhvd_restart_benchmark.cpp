@@ -0,0 +1,247 @@
+/*
+ * UNHVD sender restart recovery benchmark
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Simulates sender restarted repeatedly. Each session goes silent (network timeout)
+ * and restarts in the middle of group of pictures, so decoder outputs frames
+ * without references until the next keyframe. Frames come from in process source
+ * (no network and NHVD), so only pipeline part of recovery is measured, not the
+ * decoder itself. Reports for each mode (resync off/on):
+ * - recovery latency, time from first data of the session to its first published set
+ * - sets published from frames decoded without references
+ * - frames discarded waiting for keyframe
+ *
+ * With hardware configuration given also measures cold and warm (keep_warm)
+ * initialization of network decoder.
+ *
+ * Usage: unhvd-restart-benchmark [restarts] [port hardware codec device pixel_format]
+ * e.g.   unhvd-restart-benchmark 20 9766 vaapi h264 /dev/dri/renderD128 bgr0
+ */
+
+#include "unhvd_test_common.h"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+const int GOP = 30; //keyframe every GOP frames
+const int SESSION_FRAMES = 3 * GOP;
+const int FRAME_INTERVAL_US = 2000;
+
+struct test_session
+{
+	std::chrono::steady_clock::time_point start; //first data
+	int64_t first_key_pts;
+	int64_t first_set_pts; //-1 until published
+	int recovery_us;
+	int unreferenced_sets; //published before keyframe
+};
+
+// sender streaming restarts sessions starting at different positions of group of pictures
+struct test_source
+{
+	AVFrame *depth;
+	AVFrame *lent;
+	int restarts;
+	int session; //current session, restarts when finished
+	int frame; //frame of current session, -1 during silence
+	int64_t pts;
+	vector<test_session> sessions; //decoding thread only until finished
+	std::atomic<bool> finished;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	if(s->session >= s->restarts)
+	{
+		s->finished = true;
+		return unhvd_test_timeout(frames);
+	}
+
+	if(s->frame < 0)
+	{	//silence between sessions, network timeout ends session
+		s->frame = 0;
+		return unhvd_test_timeout(frames);
+	}
+
+	std::this_thread::sleep_for(std::chrono::microseconds(FRAME_INTERVAL_US));
+
+	//session starts at varying position in group of pictures
+	const int offset = (7 * s->session + 5) % GOP;
+	const bool key = (s->frame + offset) % GOP == 0;
+
+	test_session &session = s->sessions[s->session];
+
+	if(s->frame == 0)
+		session.start = std::chrono::steady_clock::now();
+	if(key && session.first_key_pts < 0)
+		session.first_key_pts = s->pts;
+
+	av_frame_unref(s->lent);
+	av_frame_ref(s->lent, s->depth);
+	s->lent->pts = s->pts++;
+	unhvd_test_set_key(s->lent, key);
+
+	frames[0] = s->lent;
+	frames[1] = frames[2] = NULL;
+
+	if(++s->frame == SESSION_FRAMES)
+	{
+		s->frame = -1;
+		++s->session;
+	}
+
+	return NHVD_OK;
+}
+
+static void test_callback(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user)
+{
+	test_source *s = (test_source*)user;
+
+	//session that fed this frame (the last frame of session is fed after increment)
+	const int index = s->frame == -1 ? s->session - 1 : s->session;
+
+	if(index < 0 || index >= s->restarts)
+		return;
+
+	test_session &session = s->sessions[index];
+
+	if(session.first_key_pts < 0 || info[0].pts < session.first_key_pts)
+		++session.unreferenced_sets;
+
+	if(session.first_set_pts < 0)
+	{
+		session.first_set_pts = info[0].pts;
+		session.recovery_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - session.start).count();
+	}
+}
+
+static void test_restarts(int restarts, bool resync)
+{
+	test_source source;
+	source.depth = unhvd_test_frame(AV_PIX_FMT_P010LE, 64, 48, 0);
+	unhvd_test_fill_depth(source.depth, 10000);
+	source.lent = av_frame_alloc();
+	source.restarts = restarts;
+	source.session = 0;
+	source.frame = -1;
+	source.pts = 0;
+	source.finished = false;
+
+	const test_session empty = {std::chrono::steady_clock::time_point(), -1, -1, 0, 0};
+	source.sessions.assign(restarts, empty);
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.callback = test_callback;
+	pipeline.callback_user = &source;
+	pipeline.resync = resync;
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 1, NULL, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	while(!source.finished)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	unhvd_close(u);
+
+	UNHVD_CHECK(stats.sessions == (uint64_t)restarts);
+
+	int unreferenced = 0;
+	vector<int> recovery;
+
+	for(int i=0;i<restarts;++i)
+	{
+		const test_session &s = source.sessions[i];
+
+		UNHVD_CHECK(s.first_set_pts >= 0);
+		//with resync the first set of session is decoded from keyframe
+		UNHVD_CHECK(!resync || s.first_set_pts == s.first_key_pts);
+
+		unreferenced += s.unreferenced_sets;
+		recovery.push_back(s.recovery_us);
+	}
+
+	UNHVD_CHECK(!resync || unreferenced == 0);
+	UNHVD_CHECK(resync || stats.resync_dropped == 0);
+
+	sort(recovery.begin(), recovery.end());
+
+	printf("resync %s: %d restarts, recovery latency %d us median, %d us max (%d us frame interval)\n",
+		resync ? "on " : "off", restarts, recovery[restarts / 2], recovery.back(), FRAME_INTERVAL_US);
+	printf("    %d sets published without references, %llu frames discarded waiting for keyframe, %d us max time to first set\n",
+		unreferenced, (unsigned long long)stats.resync_dropped, stats.time_to_first_set_max_us);
+
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+}
+
+// network decoder initialization cold (nhvd_init) and warm (parked by previous close)
+static void test_warm_pool(int restarts, char **argv)
+{
+	unhvd_net_config net = {NULL, (uint16_t)atoi(argv[0]), 500};
+	unhvd_hw_config hw = {argv[1], argv[2], argv[3], argv[4], 0, 0, 0};
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.keep_warm = 1;
+
+	int cold_us = 0, warm_max_us = 0;
+	double warm_us = 0.0;
+
+	for(int i=0;i<restarts;++i)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		unhvd *u = unhvd_init_pipeline(&net, &hw, 1, NULL, &pipeline);
+		UNHVD_CHECK(u != NULL);
+
+		const int elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		unhvd_stats stats;
+		UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+		UNHVD_CHECK(stats.warm_start == (i > 0));
+
+		if(i == 0)
+			cold_us = elapsed_us;
+		else
+		{
+			warm_us += elapsed_us;
+			warm_max_us = max(warm_max_us, elapsed_us);
+		}
+
+		unhvd_close(u);
+	}
+
+	unhvd_warm_pool_clear();
+
+	printf("init: cold %d us, warm %.0f us average, %d us max\n",
+		cold_us, restarts > 1 ? warm_us / (restarts - 1) : 0.0, warm_max_us);
+}
+
+int main(int argc, char **argv)
+{
+	const int restarts = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 5;
+
+	test_restarts(restarts, false);
+	test_restarts(restarts, true);
+
+	if(argc == 7)
+		test_warm_pool(restarts, argv + 2);
+
+	return 0;
+}
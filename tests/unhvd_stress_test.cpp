@@ -0,0 +1,335 @@
+/*
+ * UNHVD multi-consumer stress test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Runs the decoding thread at full speed while several threads concurrently:
+ * - retrieve sets with unhvd_get_begin, frame info and summary
+ * - wait for sets with unhvd_wait_begin
+ * - poll unhvd_get_fd and retrieve point cloud level of detail
+ * - reconfigure unprojection with unhvd_set_depth_config
+ * - read statistics
+ *
+ * and checks every retrieved set is consistent. Meant to run with
+ * UNHVD_SANITIZE=thread and UNHVD_SANITIZE=address.
+ *
+ * Also checks that descriptor consumer is woken when decoding thread
+ * finishes on fatal error.
+ *
+ * Usage: unhvd-stress-test [duration_ms]
+ */
+
+#include "unhvd_test_common.h"
+
+#include <atomic>
+#include <vector>
+#include <math.h>
+#include <poll.h>
+
+using namespace std;
+
+const int WIDTH = 64, HEIGHT = 48;
+const int ROI_POINTS = (WIDTH / 2) * (HEIGHT / 2); //with region of interest
+const int ALL_POINTS = WIDTH * HEIGHT; //whole frame
+
+struct test_source
+{
+	AVFrame *depth;
+	AVFrame *texture;
+	AVFrame *lent[2];
+	int64_t pts;
+	int64_t fail_at; //fatal error at this frame, -1 never
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	//short enough to keep consumers contending, long enough for them to get the mutex
+	std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+	if(s->pts == s->fail_at)
+		return NHVD_ERROR;
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+	av_frame_ref(s->lent[0], s->depth);
+	av_frame_ref(s->lent[1], s->texture);
+	s->lent[0]->pts = s->lent[1]->pts = s->pts++;
+
+	frames[0] = s->lent[0];
+	frames[1] = s->lent[1];
+	frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+struct test_shared
+{
+	unhvd *u;
+	std::atomic<bool> keep_working;
+	std::atomic<int> retrieved[4];
+	std::atomic<int> reconfigured;
+};
+
+static unhvd_depth_config test_depth_config()
+{
+	unhvd_depth_config dc;
+	memset(&dc, 0, sizeof(dc));
+	dc.ppx = WIDTH / 2;
+	dc.ppy = HEIGHT / 2;
+	dc.fx = dc.fy = 32.0f;
+	dc.depth_unit = 0.0001f;
+	dc.min_margin = 0.1f;
+	dc.max_margin = 0.01f; //below the top of encoded depth range
+
+	return dc;
+}
+
+// whole frame or quarter of it, both with summary and one level of detail
+static unhvd_depth_ext_config test_depth_ext(bool roi)
+{
+	unhvd_depth_ext_config ext;
+	memset(&ext, 0, sizeof(ext));
+	ext.roi_width = roi ? WIDTH / 2 : 0;
+	ext.roi_height = roi ? HEIGHT / 2 : 0;
+	ext.summary = 1;
+	ext.histogram_max = 4.0f;
+	ext.lod_levels = 1;
+
+	return ext;
+}
+
+// retrieved set is complete, fresh and its point cloud matches one of configurations
+static void test_check_set(unhvd *u, const unhvd_frame *frame, const unhvd_point_cloud *pc, int64_t *last_pts)
+{
+	unhvd_frame_info info[2];
+	UNHVD_CHECK(unhvd_get_frame_info(u, info) == UNHVD_OK);
+
+	UNHVD_CHECK(info[0].fresh && info[1].fresh && info[0].pts == info[1].pts);
+	UNHVD_CHECK(info[0].pts > *last_pts);
+	*last_pts = info[0].pts;
+
+	UNHVD_CHECK(frame[0].width == WIDTH && frame[0].height == HEIGHT && frame[0].data[0]);
+	UNHVD_CHECK(frame[1].format == AV_PIX_FMT_RGB0 && frame[1].data[0]);
+	UNHVD_CHECK(((uint16_t*)frame[0].data[0])[0] == 20000);
+
+	UNHVD_CHECK(pc->used == ALL_POINTS || pc->used == ROI_POINTS);
+	UNHVD_CHECK(pc->used <= pc->size);
+	UNHVD_CHECK(pc->colors[0] == 0xFF336699 && pc->colors[pc->used - 1] == 0xFF336699);
+	UNHVD_CHECK(fabsf(pc->data[pc->used - 1][2] - 2.0f) < 1e-4f);
+
+	unhvd_point_cloud_summary summary;
+	UNHVD_CHECK(unhvd_get_point_cloud_summary(u, 0, &summary) == UNHVD_OK);
+	UNHVD_CHECK(summary.histogram[32] == (uint32_t)pc->used);
+}
+
+static void test_get_consumer(test_shared *s)
+{
+	unhvd_frame frame[2];
+	unhvd_point_cloud pc;
+	int64_t last_pts = -1;
+
+	while(s->keep_working)
+	{
+		if(unhvd_get_begin(s->u, frame, &pc) == UNHVD_OK)
+		{
+			test_check_set(s->u, frame, &pc, &last_pts);
+			++s->retrieved[0];
+		}
+
+		UNHVD_CHECK(unhvd_get_end(s->u) == UNHVD_OK);
+		std::this_thread::yield();
+	}
+}
+
+static void test_wait_consumer(test_shared *s)
+{
+	unhvd_frame frame[2];
+	unhvd_point_cloud pc;
+	int64_t last_pts = -1;
+
+	while(s->keep_working)
+	{
+		if(unhvd_wait_begin(s->u, frame, &pc, 100) == UNHVD_OK)
+		{
+			test_check_set(s->u, frame, &pc, &last_pts);
+			++s->retrieved[1];
+		}
+
+		UNHVD_CHECK(unhvd_get_end(s->u) == UNHVD_OK);
+	}
+}
+
+// event driven consumer of decimated level
+static void test_fd_consumer(test_shared *s)
+{
+	struct pollfd pfd = {unhvd_get_fd(s->u), POLLIN, 0};
+	UNHVD_CHECK(pfd.fd >= 0);
+
+	unhvd_point_cloud pc;
+	unhvd_point_cloud_summary summary;
+
+	while(s->keep_working)
+	{
+		if(poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		//other consumers may have taken the set in the meantime
+		if(unhvd_get_point_cloud_level_begin(s->u, 1, &pc) == UNHVD_OK)
+		{
+			UNHVD_CHECK(pc.used == ALL_POINTS / 4 || pc.used == ROI_POINTS / 4);
+			UNHVD_CHECK(unhvd_get_point_cloud_summary(s->u, 1, &summary) == UNHVD_OK);
+			UNHVD_CHECK(summary.histogram[32] == (uint32_t)pc.used);
+			++s->retrieved[2];
+		}
+
+		UNHVD_CHECK(unhvd_get_point_cloud_end(s->u) == UNHVD_OK);
+	}
+}
+
+static void test_reconfigure(test_shared *s)
+{
+	const unhvd_depth_config dc = test_depth_config();
+
+	for(int i=0;s->keep_working;++i)
+	{
+		const unhvd_depth_ext_config ext = test_depth_ext(i % 2 == 0);
+		UNHVD_CHECK(unhvd_set_depth_config(s->u, &dc, &ext) == UNHVD_OK);
+		++s->reconfigured;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+static void test_stats_reader(test_shared *s)
+{
+	unhvd_stats stats;
+	uint64_t last_sets = 0;
+
+	while(s->keep_working)
+	{
+		UNHVD_CHECK(unhvd_get_stats(s->u, &stats) == UNHVD_OK);
+		UNHVD_CHECK(stats.sets >= last_sets);
+		last_sets = stats.sets;
+		++s->retrieved[3];
+		std::this_thread::yield();
+	}
+}
+
+// descriptor consumer gets sets published before fatal error, then descriptor stays readable
+static void test_fatal_error(test_source *source)
+{
+	const int64_t FAIL_AT = 5;
+	const unhvd_depth_config dc = test_depth_config();
+
+	source->pts = 0;
+	source->fail_at = FAIL_AT;
+
+	unhvd *u = unhvd_test_init(test_source_receive, source, 2, &dc, NULL);
+	UNHVD_CHECK(u != NULL);
+
+	struct pollfd pfd = {unhvd_get_fd(u), POLLIN, 0};
+	unhvd_frame frame[2];
+	unhvd_frame_info info[2];
+	int64_t last_pts = -1;
+	int status;
+
+	do
+	{	//blocking forever here means consumer was not woken
+		UNHVD_CHECK(poll(&pfd, 1, 5000) == 1);
+
+		if( (status = unhvd_get_begin(u, frame, NULL)) == UNHVD_OK)
+		{
+			UNHVD_CHECK(unhvd_get_frame_info(u, info) == UNHVD_OK);
+			last_pts = info[0].pts;
+		}
+
+		UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	} while(status == UNHVD_OK);
+
+	UNHVD_CHECK(last_pts == FAIL_AT - 1);
+
+	//readable without new data, level triggered consumers keep getting UNHVD_ERROR
+	UNHVD_CHECK(poll(&pfd, 1, 0) == 1);
+	UNHVD_CHECK(unhvd_get_begin(u, frame, NULL) == UNHVD_ERROR);
+	UNHVD_CHECK(unhvd_get_end(u) == UNHVD_OK);
+	UNHVD_CHECK(poll(&pfd, 1, 0) == 1);
+
+	unhvd_close(u);
+}
+
+int main(int argc, char **argv)
+{
+	const int duration_ms = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 2000;
+
+	test_source source;
+	source.depth = unhvd_test_frame(AV_PIX_FMT_P016LE, WIDTH, HEIGHT, 0);
+	source.texture = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_depth(source.depth, 20000);
+	unhvd_test_fill_texture(source.texture, 0xFF336699);
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+	source.fail_at = -1;
+
+	const unhvd_depth_config dc = test_depth_config();
+	const unhvd_depth_ext_config ext = test_depth_ext(false);
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sync = 1;
+	pipeline.depth_ext = &ext;
+
+	test_shared shared;
+	shared.u = unhvd_test_init(test_source_receive, &source, 2, &dc, &pipeline);
+	UNHVD_CHECK(shared.u != NULL);
+	shared.keep_working = true;
+	shared.reconfigured = 0;
+
+	for(int i=0;i<4;++i)
+		shared.retrieved[i] = 0;
+
+	vector<thread> threads;
+	threads.push_back(thread(test_get_consumer, &shared));
+	threads.push_back(thread(test_get_consumer, &shared));
+	threads.push_back(thread(test_wait_consumer, &shared));
+	threads.push_back(thread(test_wait_consumer, &shared));
+	threads.push_back(thread(test_fd_consumer, &shared));
+	threads.push_back(thread(test_reconfigure, &shared));
+	threads.push_back(thread(test_stats_reader, &shared));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+
+	shared.keep_working = false;
+
+	for(size_t i=0;i<threads.size();++i)
+		threads[i].join();
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(shared.u, &stats) == UNHVD_OK);
+	unhvd_close(shared.u);
+
+	printf("%llu sets: %d get, %d wait, %d fd level retrievals, %d reconfigurations, %d stats reads\n",
+		(unsigned long long)stats.sets, shared.retrieved[0].load(), shared.retrieved[1].load(),
+		shared.retrieved[2].load(), shared.reconfigured.load(), shared.retrieved[3].load());
+
+	UNHVD_CHECK(stats.sets > 0 && stats.unproject_rejected == 0);
+	UNHVD_CHECK(shared.retrieved[0] + shared.retrieved[1] > 0);
+	UNHVD_CHECK(shared.reconfigured > 0);
+
+	test_fatal_error(&source);
+
+	av_frame_free(&source.depth);
+	av_frame_free(&source.texture);
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+
+	printf("unhvd stress test passed\n");
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * UNHVD tests common helpers
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_TEST_COMMON_H
+#define UNHVD_TEST_COMMON_H
+
+#include "../unhvd.h"
+#include "../unhvd_test.h"
+
+// Network Hardware Video Decoder library (FFmpeg frames)
+#include "nhvd.h"
+
+extern "C" {
+#include <libavutil/version.h> //LIBAVUTIL_VERSION_INT
+}
+
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define UNHVD_CHECK(condition) \
+	do { \
+		if(!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			exit(EXIT_FAILURE); \
+		} \
+	} while(0)
+
+// source behaviour when it has nothing to feed
+static inline int unhvd_test_timeout(AVFrame *frames[])
+{
+	for(int i=0;i<UNHVD_MAX_DECODERS;++i)
+		frames[i] = NULL;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return NHVD_TIMEOUT;
+}
+
+// marks frame as keyframe, AVFrame::key_frame is deprecated since FFmpeg 6.1
+static inline void unhvd_test_set_key(AVFrame *frame, bool key)
+{
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+	frame->flags = key ? frame->flags | AV_FRAME_FLAG_KEY : frame->flags & ~AV_FRAME_FLAG_KEY;
+#else
+	frame->key_frame = key;
+#endif
+}
+
+// frame with allocated (uninitialized) buffers
+static inline AVFrame *unhvd_test_frame(int format, int width, int height, int64_t pts)
+{
+	AVFrame *frame = av_frame_alloc();
+	UNHVD_CHECK(frame != NULL);
+
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	frame->pts = pts;
+
+	UNHVD_CHECK(av_frame_get_buffer(frame, 32) == 0);
+
+	return frame;
+}
+
+// depth frame (p010le/p016le) with the same value in every pixel
+static inline void unhvd_test_fill_depth(AVFrame *frame, uint16_t value)
+{
+	for(int y=0;y<frame->height;++y)
+	{
+		uint16_t *row = (uint16_t*)(frame->data[0] + y * frame->linesize[0]);
+
+		for(int x=0;x<frame->width;++x)
+			row[x] = value;
+	}
+}
+
+// texture frame (rgb0/rgba) with the same color in every pixel
+static inline void unhvd_test_fill_texture(AVFrame *frame, uint32_t color)
+{
+	for(int y=0;y<frame->height;++y)
+	{
+		uint32_t *row = (uint32_t*)(frame->data[0] + y * frame->linesize[0]);
+
+		for(int x=0;x<frame->width;++x)
+			row[x] = color;
+	}
+}
+
+// depth frame (p010le/p016le) of floor-like slope with box in the middle and sensor noise
+// about 1/8 of pixels is invalid (0) like shadows of stereo depth, seed varies noise
+static inline void unhvd_test_fill_scene(AVFrame *frame, unsigned int seed)
+{
+	for(int y=0;y<frame->height;++y)
+	{
+		uint16_t *row = (uint16_t*)(frame->data[0] + y * frame->linesize[0]);
+
+		for(int x=0;x<frame->width;++x)
+		{
+			seed = seed * 1103515245u + 12345u;
+			const unsigned int noise = (seed >> 16) & 0x7;
+
+			const bool box = x > frame->width / 3 && x < 2 * frame->width / 3 &&
+				y > frame->height / 3 && y < 2 * frame->height / 3;
+
+			//in 0.0001 units: 4 m at the top to 1 m at the bottom, box at 1.5 m
+			const int depth = box ? 15000 : 40000 - 30000 * y / frame->height;
+
+			row[x] = ((seed >> 20) & 0x7) == 0 ? 0 : depth + noise;
+		}
+	}
+}
+
+// loopback port for publisher tests, varies between processes
+static inline uint16_t unhvd_test_port()
+{
+	return 20000 + getpid() % 10000;
+}
+
+// connect to loopback publisher, returns socket
+static inline int unhvd_test_connect(uint16_t port)
+{
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	UNHVD_CHECK(fd != -1);
+	UNHVD_CHECK(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0);
+
+	return fd;
+}
+
+// false on disconnect
+static inline bool unhvd_test_read_all(int fd, uint8_t *data, size_t size)
+{
+	while(size)
+	{
+		const ssize_t n = recv(fd, data, size, 0);
+
+		if(n <= 0)
+			return false;
+
+		data += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+// wait until predicate holds for statistics, false on timeout
+template<typename Predicate>
+static bool unhvd_test_wait_stats(unhvd *u, Predicate predicate, int timeout_ms = 5000)
+{
+	const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	unhvd_stats stats;
+
+	do
+	{
+		UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+
+		if(predicate(stats))
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	while(std::chrono::steady_clock::now() < end);
+
+	return false;
+}
+
+#endif
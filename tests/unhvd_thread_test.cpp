@@ -0,0 +1,153 @@
+/*
+ * UNHVD pipeline threads scheduling test
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Configures decoding, publisher and recorder threads with CPU affinity
+ * and nice values (allowed without privileges) and checks effective
+ * CPU, policy and priority reported in statistics.
+ */
+
+#include "unhvd_test_common.h"
+
+#include <sched.h>
+
+const int WIDTH = 64, HEIGHT = 48;
+
+struct test_source
+{
+	AVFrame *depth;
+	AVFrame *lent;
+	int64_t pts;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	av_frame_unref(s->lent);
+	av_frame_ref(s->lent, s->depth);
+	s->lent->pts = s->pts++;
+
+	frames[0] = s->lent;
+	frames[1] = frames[2] = NULL;
+
+	return NHVD_OK;
+}
+
+// the last CPU the process may run on
+static int test_allowed_cpu()
+{
+	cpu_set_t cpus;
+	UNHVD_CHECK(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+
+	int cpu = -1;
+
+	for(int i=0;i<64;++i)
+		if(CPU_ISSET(i, &cpus))
+			cpu = i;
+
+	UNHVD_CHECK(cpu >= 0);
+	return cpu;
+}
+
+int main(int argc, char **argv)
+{
+	const int cpu = test_allowed_cpu();
+	const uint64_t mask = (uint64_t)1 << cpu;
+
+	test_source source;
+	source.depth = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_depth(source.depth, 10000);
+	source.lent = av_frame_alloc();
+	source.pts = 0;
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = WIDTH / 2;
+	depth.ppy = HEIGHT / 2;
+	depth.fx = depth.fy = 32.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	unhvd_publish_config publish;
+	memset(&publish, 0, sizeof(publish));
+	publish.ip = "127.0.0.1";
+	publish.port = unhvd_test_port();
+
+	unhvd_record_config recording = {"/dev/null", 2};
+
+	//nice values can be increased without privileges
+	const unhvd_thread_config decoder_thread = {"unhvd-test-dec", mask, UNHVD_SCHED_DEFAULT, 3};
+	const unhvd_thread_config publisher_thread = {"unhvd-test-pub", mask, UNHVD_SCHED_DEFAULT, 5};
+	const unhvd_thread_config recorder_thread = {"unhvd-test-rec", mask, UNHVD_SCHED_DEFAULT, 7};
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.publish = &publish;
+	pipeline.record = &recording;
+	pipeline.decoder_thread = decoder_thread;
+	pipeline.publisher_thread = publisher_thread;
+	pipeline.recorder_thread = recorder_thread;
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 1, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	//the subscriber makes publisher thread send (and report CPU it sends from)
+	const int subscriber = unhvd_test_connect(publish.port);
+
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [](const unhvd_stats &s){ return s.published >= 10 && s.recorded >= 10; }));
+
+	//statistics of background threads are collected with the next set
+	unhvd_stats before;
+	UNHVD_CHECK(unhvd_get_stats(u, &before) == UNHVD_OK);
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [&before](const unhvd_stats &s){ return s.sets > before.sets + 1; }));
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+
+	printf("decoder cpu %d policy %d priority %d\n", stats.decoder_thread_cpu, stats.decoder_thread_policy, stats.decoder_thread_priority);
+	printf("publisher cpu %d policy %d priority %d\n", stats.publisher_thread_cpu, stats.publisher_thread_policy, stats.publisher_thread_priority);
+	printf("recorder cpu %d policy %d priority %d\n", stats.recorder_thread_cpu, stats.recorder_thread_policy, stats.recorder_thread_priority);
+
+	UNHVD_CHECK(stats.decoder_thread_cpu == cpu);
+	UNHVD_CHECK(stats.decoder_thread_policy == UNHVD_SCHED_DEFAULT && stats.decoder_thread_priority == 3);
+
+	UNHVD_CHECK(stats.publisher_thread_cpu == cpu);
+	UNHVD_CHECK(stats.publisher_thread_policy == UNHVD_SCHED_DEFAULT && stats.publisher_thread_priority == 5);
+
+	UNHVD_CHECK(stats.recorder_thread_cpu == cpu);
+	UNHVD_CHECK(stats.recorder_thread_policy == UNHVD_SCHED_DEFAULT && stats.recorder_thread_priority == 7);
+
+	unhvd_close(u);
+	close(subscriber);
+
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+
+	//without publisher and recorder their CPU is unknown
+	source.depth = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_depth(source.depth, 10000);
+	source.lent = av_frame_alloc();
+
+	u = unhvd_test_init(test_source_receive, &source, 1, NULL, NULL);
+	UNHVD_CHECK(u != NULL);
+	UNHVD_CHECK(unhvd_test_wait_stats(u, [](const unhvd_stats &s){ return s.sets >= 1; }));
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	UNHVD_CHECK(stats.publisher_thread_cpu == -1 && stats.recorder_thread_cpu == -1);
+	unhvd_close(u);
+
+	av_frame_free(&source.depth);
+	av_frame_free(&source.lent);
+
+	printf("unhvd thread test passed\n");
+	return 0;
+}
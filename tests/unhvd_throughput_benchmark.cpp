@@ -0,0 +1,214 @@
+/*
+ * UNHVD decoding thread throughput benchmark
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ *
+ * Feeds synthetic 848x480 depth + texture sets at 60 fps (as 2 hardware decoders would)
+ * and measures time the decoding thread spends on each set (matching, unprojection,
+ * callback, recording) against 16.7 ms frame budget. Reports for each mode:
+ * - achieved sets per second
+ * - processing time per set (average, 99th percentile, maximum)
+ * - sets dropped by recorder
+ *
+ * Recording is read back and checked against fed frames and published point clouds.
+ *
+ * Usage: unhvd-throughput-benchmark [sets] [recording path]
+ */
+
+#include "unhvd_test_common.h"
+#include "../unhvd_record.h"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+const int WIDTH = 848, HEIGHT = 480;
+const int FPS = 60;
+const int TEMPLATES = 4;
+
+struct test_source
+{
+	AVFrame *depth[TEMPLATES];
+	AVFrame *texture;
+	AVFrame *lent[2];
+	int64_t pts;
+	int sets; //to feed, then timeout
+	std::chrono::steady_clock::time_point next; //pacing
+	std::chrono::steady_clock::time_point returned; //last set returned to pipeline
+	vector<int> processing_us; //decoding thread only until finished
+	std::atomic<bool> finished;
+};
+
+static int test_source_receive(AVFrame *frames[], void *user)
+{
+	test_source *s = (test_source*)user;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	//time between handing the set to pipeline and being asked for the next one
+	if(s->pts > 0 && s->pts <= s->sets)
+		s->processing_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - s->returned).count());
+
+	if(s->pts >= s->sets)
+	{
+		s->finished = true;
+		return unhvd_test_timeout(frames);
+	}
+
+	if(s->pts == 0)
+		s->next = now;
+
+	std::this_thread::sleep_until(s->next);
+	s->next += std::chrono::microseconds(1000000 / FPS);
+
+	av_frame_unref(s->lent[0]);
+	av_frame_unref(s->lent[1]);
+	av_frame_ref(s->lent[0], s->depth[s->pts % TEMPLATES]);
+	av_frame_ref(s->lent[1], s->texture);
+	s->lent[0]->pts = s->lent[1]->pts = s->pts++;
+
+	frames[0] = s->lent[0];
+	frames[1] = s->lent[1];
+	frames[2] = NULL;
+
+	s->returned = std::chrono::steady_clock::now();
+
+	return NHVD_OK;
+}
+
+// number of points callback got for each set (by pts)
+static void test_callback(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user)
+{
+	vector<int> *points = (vector<int>*)user;
+
+	if(pc && info[0].pts < (int64_t)points->size())
+		(*points)[info[0].pts] = pc->used;
+}
+
+// recorded sets have fed frames (by pts) and published point clouds
+static void test_check_recording(const char *path, const test_source *source, const vector<int> &points, int recorded)
+{
+	unhvd_record_reader *reader = unhvd_record_open(path);
+	UNHVD_CHECK(reader != NULL);
+	UNHVD_CHECK(unhvd_record_entries(reader) == recorded);
+
+	for(int i=0;i<unhvd_record_entries(reader);++i)
+	{
+		unhvd_record_entry entry;
+		UNHVD_CHECK(unhvd_record_read(reader, i, &entry) == UNHVD_OK);
+		UNHVD_CHECK(entry.frames == 2);
+
+		const AVFrame *depth = source->depth[entry.pts % TEMPLATES];
+		const unhvd_frame *f = &entry.frame[0];
+
+		UNHVD_CHECK(f->width == WIDTH && f->height == HEIGHT && f->format == AV_PIX_FMT_P010LE);
+		UNHVD_CHECK(f->data[0] && f->linesize[0] == depth->linesize[0]);
+		UNHVD_CHECK(memcmp(f->data[0], depth->data[0], (size_t)depth->linesize[0] * HEIGHT) == 0);
+		UNHVD_CHECK(memcmp(entry.frame[1].data[0], source->texture->data[0], (size_t)source->texture->linesize[0] * HEIGHT) == 0);
+
+		UNHVD_CHECK(entry.pc.data && entry.pc.used == points[entry.pts]);
+	}
+
+	unhvd_record_close(reader);
+}
+
+static void test_benchmark(int sets, const char *record_path)
+{
+	test_source source;
+
+	for(int t=0;t<TEMPLATES;++t)
+	{
+		source.depth[t] = unhvd_test_frame(AV_PIX_FMT_P010LE, WIDTH, HEIGHT, 0);
+		unhvd_test_fill_scene(source.depth[t], t + 1);
+	}
+
+	source.texture = unhvd_test_frame(AV_PIX_FMT_RGB0, WIDTH, HEIGHT, 0);
+	unhvd_test_fill_texture(source.texture, 0xFF336699);
+	source.lent[0] = av_frame_alloc();
+	source.lent[1] = av_frame_alloc();
+	source.pts = 0;
+	source.sets = sets;
+	source.processing_us.reserve(sets);
+	source.finished = false;
+
+	vector<int> points(sets, -1);
+
+	unhvd_depth_config depth;
+	memset(&depth, 0, sizeof(depth));
+	depth.ppx = WIDTH / 2;
+	depth.ppy = HEIGHT / 2;
+	depth.fx = depth.fy = 420.0f;
+	depth.depth_unit = 0.0001f;
+	depth.min_margin = 0.1f;
+	depth.max_margin = 0.01f; //below the top of encoded depth range
+
+	unhvd_record_config recording = {record_path, 0};
+
+	unhvd_pipeline_config pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sync = 1;
+	pipeline.callback = test_callback;
+	pipeline.callback_user = &points;
+	pipeline.record = record_path ? &recording : NULL;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	unhvd *u = unhvd_test_init(test_source_receive, &source, 2, &depth, &pipeline);
+	UNHVD_CHECK(u != NULL);
+
+	while(!source.finished)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unhvd_stats stats;
+	UNHVD_CHECK(unhvd_get_stats(u, &stats) == UNHVD_OK);
+	unhvd_close(u); //writes recording index
+
+	UNHVD_CHECK(stats.sets == (uint64_t)sets);
+	//recorder statistics lag, all sets not dropped are written before close
+	const int recorded = record_path ? sets - (int)stats.record_dropped : 0;
+
+	vector<int> &us = source.processing_us;
+	sort(us.begin(), us.end());
+
+	double average_us = 0.0;
+	for(size_t i=0;i<us.size();++i)
+		average_us += us[i];
+	average_us /= us.size();
+
+	printf("%s: %d sets of 2x%dx%d, %.1f sets/s (%d fps fed)\n", record_path ? "recording " : "unprojection",
+		sets, WIDTH, HEIGHT, sets / elapsed_s, FPS);
+	printf("    processing per set %.0f us average, %d us p99, %d us max (%d us budget), %d recorded, %llu dropped by recorder\n",
+		average_us, us[us.size() * 99 / 100], us.back(), 1000000 / FPS, recorded, (unsigned long long)stats.record_dropped);
+
+	if(record_path)
+		test_check_recording(record_path, &source, points, recorded);
+
+	for(int t=0;t<TEMPLATES;++t)
+		av_frame_free(&source.depth[t]);
+
+	av_frame_free(&source.texture);
+	av_frame_free(&source.lent[0]);
+	av_frame_free(&source.lent[1]);
+}
+
+int main(int argc, char **argv)
+{
+	const int sets = argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 120;
+	const char *record_path = argc > 2 ? argv[2] : "unhvd_throughput_benchmark.rec";
+
+	test_benchmark(sets, NULL);
+	test_benchmark(sets, record_path);
+
+	if(argc <= 2)
+		remove(record_path);
+
+	return 0;
+}
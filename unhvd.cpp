@@ -15,17 +15,178 @@
 #include "nhvd.h"
 // Hardware Depth Unprojector library
 #include "hdu.h"
+// Point cloud re-streaming
+#include "unhvd_publisher.h"
+#include "unhvd_recorder.h"
+// Pipeline thread scheduling
+#include "unhvd_thread.h"
+// Synthetic frame source for tests
+#include "unhvd_test.h"
 
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <string.h> //memset
+#include <math.h> //fabsf, sqrtf
+#include <float.h> //FLT_MAX
+#include <stdint.h> //INT64_MAX, INT64_MIN
+#include <algorithm> //min, max
+
+#if defined(_WIN32)
+#include <malloc.h> //_aligned_malloc, _aligned_free
+#else
+#include <stdlib.h> //posix_memalign, free
+#endif
+
+extern "C" {
+#include <libavutil/version.h> //LIBAVUTIL_VERSION_INT
+}
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/mman.h> //madvise, memfd_create, mmap
+#include <sys/ioctl.h>
+#include <linux/udmabuf.h>
+#include <fcntl.h>
+#include <unistd.h> //close, ftruncate
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_drm.h>
+#include <libavutil/pixdesc.h>
+}
+#endif
 
 using namespace std;
 
+//point cloud storage reused as long as it has enough capacity
+struct unhvd_point_cloud_buffer
+{
+	hdu_point_cloud pc;
+	int capacity;
+	int dirty; //entries from dirty to capacity are zero
+	unhvd_point_cloud_summary summary;
+	bool has_summary;
+};
+
+//internal copy of depth configuration
+struct unhvd_depth_state
+{
+	unhvd_depth_config config;
+	unhvd_depth_ext_config ext; //rotation filled for axis aligned box, unbounded box axes FLT_MAX
+	bool box_culling;
+};
+
+//decimated depth and texture of level of detail, reused between frames
+struct unhvd_lod_buffer
+{
+	vector<uint16_t> depth;
+	vector<uint32_t> colors;
+};
+
+#if defined(__linux__)
+//memfd backed buffer described as DRM PRIME frame (UNHVD_EXPORT_MEMFD)
+struct unhvd_memfd_buffer
+{
+	int memfd;
+	int fd; //udmabuf of memfd or memfd itself
+	uint8_t *data; //mapping
+	size_t size;
+	AVDRMFrameDescriptor desc;
+	std::atomic<bool> in_use; //cleared when the last reference to exported frame is released
+};
+#endif
+
+//network decoder parked by unhvd_close for reuse (keep_warm)
+struct unhvd_warm_decoder
+{
+	nhvd *network_decoder;
+	string key; //network and hardware configuration
+	uint16_t port; //parked socket stays bound to it
+};
+
+//socket of parked decoder queues data, warm start discards what was queued
+//(returned without waiting) but at most that many frames
+const int UNHVD_WARM_DRAIN_MAX_FRAMES = 64;
+//receiving that long means the frame was not queued
+const int UNHVD_WARM_DRAIN_WAIT_US = 8000;
+
+//process wide, guarded by unhvd_warm_mutex
+static std::mutex unhvd_warm_mutex;
+static vector<unhvd_warm_decoder> unhvd_warm_pool;
+
+//rows unprojected at once, points of band are still in cache for culling and reductions
+const int UNHVD_BAND_ROWS = 16;
+
+//culling and reductions over kept points of all bands of level
+struct unhvd_reduction
+{
+	float lo[3];
+	float hi[3];
+	double sum[3];
+	float nearest; //squared
+	int kept;
+};
+
+//cache line alignment for SIMD friendly point cloud
+const size_t UNHVD_ALIGNMENT = 64;
+//buffers of at least that size are aligned for transparent huge pages
+const size_t UNHVD_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
 static void unhvd_network_decoder_thread(unhvd *n);
-static int unhvd_unproject_depth_frame(unhvd *n, const AVFrame *depth_frame, const AVFrame *texture_frame, hdu_point_cloud *pc);
+static bool unhvd_match_set(unhvd *u);
+static void unhvd_end_session(unhvd *u);
+static void unhvd_track_loss(unhvd *u, AVFrame *frames[]);
+static bool unhvd_frame_corrupt(const AVFrame *frame);
+static void unhvd_publish_set(unhvd *u, bool unprojected);
+static void unhvd_commit_stats(unhvd *u);
+static void unhvd_call_callback(unhvd *u, bool unprojected);
+static void unhvd_fill_frame(unhvd_frame *frame, const AVFrame *av);
+static void unhvd_fill_frame_info(unhvd_frame_info *info, const AVFrame *av);
+static unhvd_point_cloud unhvd_point_cloud_view(const unhvd_point_cloud_buffer *buf);
+static void unhvd_export_frame(unhvd *u, int decoder);
+#if defined(__linux__)
+static bool unhvd_export_memfd(unhvd *u, int decoder);
+static unhvd_memfd_buffer *unhvd_memfd_acquire(unhvd *u, int decoder, size_t size);
+static void unhvd_memfd_release(void *opaque, uint8_t *data);
+static void unhvd_memfd_free(unhvd_memfd_buffer *buf);
+static uint32_t unhvd_drm_format(int format);
+static int unhvd_plane_height(const AVFrame *frame, int plane);
+#endif
+static bool unhvd_new_data(const unhvd *u);
+static int unhvd_fill_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc, int level);
+static bool unhvd_unprojectable(unhvd *u, const AVFrame *depth_frame, const AVFrame *texture_frame);
+static const char *unhvd_validate_frames(const AVFrame *depth_frame, const AVFrame *texture_frame);
+static int unhvd_unproject_depth_frame(unhvd *n, const AVFrame *depth_frame, const AVFrame *texture_frame);
+static int unhvd_unproject_level(unhvd *u, int level, const hdu_depth *depth);
+static void unhvd_decimate(const hdu_depth *src, int method, unhvd_lod_buffer *lod, hdu_depth *dst);
+static int unhvd_point_cloud_reserve(unhvd *u, unhvd_point_cloud_buffer *buf, int size);
+static void unhvd_point_cloud_free(unhvd_point_cloud_buffer *buf);
+static hdu_config unhvd_hdu_config(const unhvd_depth_state *d, int level);
+static hdu *unhvd_hdu_init(const unhvd_depth_state *d, int level);
+static void unhvd_hdu_close(hdu *h[UNHVD_MAX_LOD_LEVELS]);
+static int unhvd_depth_prepare(const unhvd_depth_config *dc, const unhvd_depth_ext_config *ext,
+	hdu *h[UNHVD_MAX_LOD_LEVELS], unhvd_depth_state *d);
+static void unhvd_apply_staged_config(unhvd *u);
+static hdu *unhvd_band_unprojector(unhvd *u, int level, int band);
+static void unhvd_band_close(unhvd *u);
+static int unhvd_cull_reduce(const unhvd_depth_state *d, hdu_point_cloud *band, unhvd_reduction *r, unhvd_point_cloud_summary *s);
+static void unhvd_reduction_finish(const unhvd_depth_state *d, const unhvd_reduction *r, unhvd_point_cloud_summary *s);
+static void *unhvd_aligned_alloc(size_t size);
+static void unhvd_aligned_free(void *ptr);
+static unhvd *unhvd_init_pipeline_common(unhvd *u, int decoders,
+	const unhvd_depth_config *depth_config, const unhvd_pipeline_config *pipeline_config);
+static int unhvd_receive(unhvd *u, AVFrame *frames[]);
+static string unhvd_warm_key(const unhvd_net_config *net_config, const unhvd_hw_config *hw_config, int hw_size);
+static nhvd *unhvd_warm_take(const string &key, uint16_t port);
+static void unhvd_warm_drain(unhvd *u);
+static bool unhvd_key_frame(const AVFrame *frame);
 static unhvd *unhvd_close_and_return_null(unhvd *n, const char *msg);
 static int UNHVD_ERROR_MSG(const char *msg);
 
@@ -35,22 +196,91 @@ struct unhvd
 	int decoders;
 
 	AVFrame *frame[UNHVD_MAX_DECODERS];
-	std::mutex mutex; //guards frame and point_cloud_shared
-
-	hdu *hardware_unprojector;
-	hdu_point_cloud point_cloud, point_cloud_shared;
+	std::mutex mutex; //guards frame, point_cloud_shared and finished
+	std::condition_variable new_data; //signalled on publishing set and thread finish
+	bool finished;
+	unhvd_stats stats;
+	int event_fd; //eventfd signalled on publishing set, -1 if not available
+
+	//set assembly, accessed only by network decoder thread
+	AVFrame *pending[UNHVD_MAX_DECODERS];
+	int64_t pending_ts[UNHVD_MAX_DECODERS];
+	int64_t received; //number of received network (MLSP) frames, shared by all decoders
+	AVFrame *exported[UNHVD_MAX_DECODERS];
+	vector<unhvd_memfd_buffer*> memfd_buffers[UNHVD_MAX_DECODERS]; //owned, reused when released
+	int udmabuf; //udmabuf device or -1
+	unhvd_pipeline_config pipeline;
+	string decoder_thread_name;
+	string warm_key; //configuration of network decoder for warm pool
+	uint16_t warm_port;
+	bool resync[UNHVD_MAX_DECODERS]; //waiting for keyframe
+	//loss tracking, accessed only by network decoder thread
+	int64_t loss_pts; //timestamp of the last network frame or AV_NOPTS_VALUE
+	int64_t loss_pts_step; //the smallest timestamp difference of session, 0 if unknown
+	bool keyframe_wait[UNHVD_MAX_DECODERS]; //decoder needs keyframe after loss or corruption
+	std::chrono::steady_clock::time_point keyframe_wait_start[UNHVD_MAX_DECODERS];
+	unhvd_stats stats_local; //network decoder thread statistics, copied to stats on publish
+
+	bool depth_enabled; //constant after init, hardware_unprojector may change
+	//full resolution (level 0) and decimated levels of detail, NULL for unused levels
+	hdu *hardware_unprojector[UNHVD_MAX_LOD_LEVELS];
+	//band b > 0 of level has principal point shifted by b * UNHVD_BAND_ROWS rows (band 0 is hardware_unprojector),
+	//created by network decoder thread when frame is tall enough, closed with configuration change
+	vector<hdu*> band_unprojector[UNHVD_MAX_LOD_LEVELS];
+	unhvd_depth_state depth;
+	unhvd_lod_buffer lod[UNHVD_MAX_LOD_LEVELS]; //level 0 unused, unprojected directly from frame
+	unhvd_point_cloud_buffer point_cloud[UNHVD_MAX_LOD_LEVELS], point_cloud_shared[UNHVD_MAX_LOD_LEVELS];
+
+	//runtime reconfiguration, applied by network decoder thread at frame boundary
+	std::mutex config_mutex; //guards staged_xxx
+	std::atomic<bool> staged;
+	hdu *staged_unprojector[UNHVD_MAX_LOD_LEVELS];
+	unhvd_depth_state staged_depth;
+
+	unhvd_publisher *publisher;
+	unhvd_recorder *recorder;
 
 	thread network_thread;
-	bool keep_working;
+	std::atomic<bool> keep_working;
+
+#if defined(UNHVD_TESTING)
+	unhvd_test_source source; //replaces network decoder if not NULL
+	void *source_user;
+#endif
 
 	unhvd():
 			network_decoder(NULL),
 			decoders(0),
 			frame(), //zero out
-			hardware_unprojector(NULL),
+			finished(false),
+			stats(),
+			event_fd(-1),
+			pending(), //zero out
+			pending_ts(),
+			received(0),
+			exported(),
+			udmabuf(-1),
+			pipeline(),
+			resync(),
+			loss_pts(AV_NOPTS_VALUE),
+			loss_pts_step(0),
+			keyframe_wait(),
+			stats_local(),
+			depth_enabled(false),
+			hardware_unprojector(),
+			depth(),
 			point_cloud(),
 			point_cloud_shared(),
+			staged(false),
+			staged_unprojector(),
+			staged_depth(),
+			publisher(NULL),
+			recorder(NULL),
 			keep_working(true)
+#if defined(UNHVD_TESTING)
+			, source(NULL),
+			source_user(NULL)
+#endif
 	{}
 };
 
@@ -58,6 +288,15 @@ struct unhvd *unhvd_init(
 	const unhvd_net_config *net_config,
 	const unhvd_hw_config *hw_config, int hw_size,
 	const unhvd_depth_config *depth_config)
+{
+	return unhvd_init_pipeline(net_config, hw_config, hw_size, depth_config, NULL);
+}
+
+struct unhvd *unhvd_init_pipeline(
+	const unhvd_net_config *net_config,
+	const unhvd_hw_config *hw_config, int hw_size,
+	const unhvd_depth_config *depth_config,
+	const unhvd_pipeline_config *pipeline_config)
 {
 	nhvd_net_config nhvd_net = {net_config->ip, net_config->port, net_config->timeout_ms};
 	nhvd_hw_config nhvd_hw[UNHVD_MAX_DECODERS] = {0};
@@ -78,220 +317,1639 @@ struct unhvd *unhvd_init(
 		nhvd_hw[i] = hw;
 	}
 
-	if( (u->network_decoder = nhvd_init(&nhvd_net, nhvd_hw, hw_size, 0)) == NULL)
+	u->warm_key = unhvd_warm_key(net_config, hw_config, hw_size);
+	u->warm_port = net_config->port;
+
+	//warm decoder skips socket, hardware device and codec initialization
+	if( (u->network_decoder = unhvd_warm_take(u->warm_key, net_config->port)) != NULL)
+		u->stats_local.warm_start = u->stats.warm_start = 1;
+	else if( (u->network_decoder = nhvd_init(&nhvd_net, nhvd_hw, hw_size, 0)) == NULL)
 		return unhvd_close_and_return_null(u, "failed to initialize NHVD");
 
-	u->decoders = hw_size;
+	return unhvd_init_pipeline_common(u, hw_size, depth_config, pipeline_config);
+}
 
-	for(int i=0;i<hw_size;++i)
+#if defined(UNHVD_TESTING)
+unhvd *unhvd_test_init(unhvd_test_source source, void *source_user, int decoders,
+	const unhvd_depth_config *depth_config, const unhvd_pipeline_config *pipeline_config)
+{
+	if(decoders > UNHVD_MAX_DECODERS)
+		return unhvd_close_and_return_null(NULL, "the maximum number of decoders (compile time) exceeded");
+
+	unhvd *u=new unhvd();
+
+	u->source = source;
+	u->source_user = source_user;
+
+	return unhvd_init_pipeline_common(u, decoders, depth_config, pipeline_config);
+}
+#endif
+
+//everything but the network decoder which is already initialized
+static unhvd *unhvd_init_pipeline_common(unhvd *u, int decoders,
+	const unhvd_depth_config *depth_config, const unhvd_pipeline_config *pipeline_config)
+{
+	u->decoders = decoders;
+
+	for(int i=0;i<decoders;++i)
 	{
 		if( (u->frame[i] = av_frame_alloc() ) == NULL)
 			return unhvd_close_and_return_null(u, "not enough memory for video frame");
 
 		u->frame[i]->data[0] = NULL;
+
+		if( (u->pending[i] = av_frame_alloc() ) == NULL)
+			return unhvd_close_and_return_null(u, "not enough memory for video frame");
+
+		if( (u->exported[i] = av_frame_alloc() ) == NULL)
+			return unhvd_close_and_return_null(u, "not enough memory for video frame");
+	}
+
+	if(pipeline_config)
+	{
+		if(pipeline_config->max_skew < 0)
+			return unhvd_close_and_return_null(u, "max_skew has to be non negative");
+
+		if(pipeline_config->callback_budget_us < 0)
+			return unhvd_close_and_return_null(u, "callback_budget_us has to be non negative");
+
+		if(pipeline_config->corrupt_policy < UNHVD_CORRUPT_PUBLISH || pipeline_config->corrupt_policy > UNHVD_CORRUPT_DROP)
+			return unhvd_close_and_return_null(u, "invalid corrupt_policy");
+
+		for(int i=0;i<UNHVD_MAX_DECODERS;++i)
+			if(pipeline_config->export_dmabuf[i] < UNHVD_EXPORT_NONE || pipeline_config->export_dmabuf[i] > UNHVD_EXPORT_MEMFD)
+				return unhvd_close_and_return_null(u, "invalid export_dmabuf");
+
+		u->pipeline = *pipeline_config;
+		u->pipeline.publish = NULL; //used only during init
+		u->pipeline.record = NULL;
+		u->pipeline.depth_ext = NULL;
+		//applied by thread on start, user pointer may not outlive init
+		u->decoder_thread_name = pipeline_config->decoder_thread.name ? pipeline_config->decoder_thread.name : "";
+		u->pipeline.decoder_thread.name = u->decoder_thread_name.c_str();
 	}
 
+	bool export_dmabuf = false;
+
+	for(int i=0;i<decoders;++i)
+		export_dmabuf |= u->pipeline.export_dmabuf[i] != UNHVD_EXPORT_NONE;
+
+#if !defined(__linux__)
+	if(export_dmabuf)
+		return unhvd_close_and_return_null(u, "dmabuf export is only supported on Linux");
+#else
+	//udmabuf converts memfd to dmabuf, without it memfd is exported as is
+	if(export_dmabuf)
+		u->udmabuf = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+#endif
+
+	//depth and texture have to be in system memory for unprojection
+	if(depth_config && (u->pipeline.export_dmabuf[0] || (decoders > 1 && u->pipeline.export_dmabuf[1])) )
+		return unhvd_close_and_return_null(u, "decoders used for unprojection may not export dmabuf");
+
+	const unhvd_depth_ext_config *depth_ext = pipeline_config ? pipeline_config->depth_ext : NULL;
+
+	if(depth_ext && !depth_config)
+		return unhvd_close_and_return_null(u, "depth extension requires depth config");
+
 	if(depth_config)
+		if(unhvd_depth_prepare(depth_config, depth_ext, u->hardware_unprojector, &u->depth) != UNHVD_OK)
+			return unhvd_close_and_return_null(u, NULL);
+
+	u->depth_enabled = u->hardware_unprojector[0] != NULL;
+
+	if(pipeline_config && pipeline_config->publish)
 	{
-		const unhvd_depth_config *dc = depth_config;
-		const hdu_config hdu_cfg = {dc->ppx, dc->ppy, dc->fx, dc->fy, dc->depth_unit, dc->min_margin, dc->max_margin};
+		if(!depth_config)
+			return unhvd_close_and_return_null(u, "point cloud publishing requires depth config");
 
-		if( (u->hardware_unprojector = hdu_init(&hdu_cfg)) == NULL )
-			return unhvd_close_and_return_null(u, "failed to initialize hardware unprojector");
+		if( (u->publisher = unhvd_publisher_init(pipeline_config->publish, &pipeline_config->publisher_thread)) == NULL)
+			return unhvd_close_and_return_null(u, "failed to initialize point cloud publisher");
 	}
 
+	if(pipeline_config && pipeline_config->record)
+		if( (u->recorder = unhvd_recorder_init(pipeline_config->record, &pipeline_config->recorder_thread)) == NULL)
+			return unhvd_close_and_return_null(u, "failed to initialize recorder");
+
+#if defined(__linux__)
+	if( (u->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		return unhvd_close_and_return_null(u, "failed to create eventfd");
+#endif
+
 	u->network_thread = thread(unhvd_network_decoder_thread, u);
 
 	return u;
 }
 
+static void unhvd_hdu_close(hdu *h[UNHVD_MAX_LOD_LEVELS])
+{
+	for(int l=0;l<UNHVD_MAX_LOD_LEVELS;++l)
+	{
+		hdu_close(h[l]);
+		h[l] = NULL;
+	}
+}
+
 static void unhvd_network_decoder_thread(unhvd *u)
 {
 	AVFrame *frames[UNHVD_MAX_DECODERS];
 	int status;
 
+	//streaming session starts with data after timeout (e.g. sender restart)
+	bool in_session = false, first_set = false;
+	std::chrono::steady_clock::time_point session_start;
+
+	unhvd_thread_setup(&u->pipeline.decoder_thread);
+	unhvd_thread_scheduling(&u->stats_local.decoder_thread_policy, &u->stats_local.decoder_thread_priority);
+	u->stats_local.decoder_thread_cpu = unhvd_thread_cpu();
+	//until publisher and recorder report
+	u->stats_local.publisher_thread_cpu = u->stats_local.recorder_thread_cpu = -1;
+
+	if(u->stats_local.warm_start)
+		unhvd_warm_drain(u);
+
+	unhvd_commit_stats(u);
 
 	while( u->keep_working &&
-	     ((status = nhvd_receive(u->network_decoder, frames) ) != NHVD_ERROR) )
+	     ((status = unhvd_receive(u, frames) ) != NHVD_ERROR) )
 	{
+		if(u->staged)
+			unhvd_apply_staged_config(u);
+
 		if(status == NHVD_TIMEOUT)
+		{
+			if(in_session)
+			{
+				unhvd_end_session(u);
+				unhvd_commit_stats(u);
+			}
+
+			in_session = first_set = false;
 			continue; //keep working
+		}
 
-		if(u->hardware_unprojector && frames[0])
-			if(unhvd_unproject_depth_frame(u, frames[0], frames[1], &u->point_cloud) != UNHVD_OK)
-				break;
+		if(!in_session)
+		{
+			in_session = first_set = true;
+			session_start = std::chrono::steady_clock::now();
+			++u->stats_local.sessions;
 
-		//the next call to nhvd_receive will unref the current
-		//frames so we have to either consume set of frames or ref it
-		std::lock_guard<std::mutex> frame_guard(u->mutex);
+			for(int i=0;i<u->decoders;++i)
+			{
+				u->resync[i] = u->pipeline.resync != 0;
+				u->keyframe_wait[i] = false;
+			}
+
+			u->loss_pts = AV_NOPTS_VALUE;
+			u->loss_pts_step = 0;
+		}
+
+		unhvd_track_loss(u, frames);
 
+		//the next call to nhvd_receive will unref the current
+		//frames so we have to either consume set of frames or take it,
+		//moving leaves blank frame for NHVD and avoids allocating references
 		for(int i=0;i<u->decoders;++i)
 			if(frames[i])
 			{
-				av_frame_unref(u->frame[i]);
-				av_frame_ref(u->frame[i], frames[i]);
+				//decoded without references until keyframe, NHVD unrefs it on the next receive
+				if(u->resync[i] && !unhvd_key_frame(frames[i]))
+				{
+					++u->stats_local.resync_dropped;
+					continue;
+				}
+
+				u->resync[i] = false;
+
+				//timestamp or network frame number if there is no timestamp,
+				//subframes of the same network frame are received together
+				//so the number doesn't drift when some subframe is lost
+				u->pending_ts[i] = frames[i]->pts != AV_NOPTS_VALUE ? frames[i]->pts : u->received;
+
+				if(u->pending[i]->data[0])
+					++u->stats_local.dropped; //unmatched frame replaced by newer one
+
+				av_frame_unref(u->pending[i]);
+				av_frame_move_ref(u->pending[i], frames[i]);
+			}
+
+		++u->received;
+
+		if(!unhvd_match_set(u))
+		{	//dropped frames are visible even if nothing is published
+			unhvd_commit_stats(u);
+			continue;
+		}
+
+		bool corrupt = false;
+
+		for(int i=0;i<u->decoders;++i)
+			if(u->pending[i]->data[0] && unhvd_frame_corrupt(u->pending[i]))
+			{
+				corrupt = true;
+				++u->stats_local.corrupt_frames;
 			}
 
-		if(u->hardware_unprojector && frames[0])
-		{	//swap internal and shared point cloud (copy 2 ints and 2 pointers)
-			hdu_point_cloud temp = u->point_cloud_shared;
-			u->point_cloud_shared = u->point_cloud;
-			u->point_cloud = temp;
+		if(corrupt && u->pipeline.corrupt_policy == UNHVD_CORRUPT_DROP)
+		{
+			for(int i=0;i<u->decoders;++i)
+				av_frame_unref(u->pending[i]);
+
+			++u->stats_local.corrupt_sets_dropped;
+			unhvd_commit_stats(u);
+			continue;
+		}
+
+		const AVFrame *depth = u->pending[0];
+		const AVFrame *texture = u->decoders > 1 ? u->pending[1] : NULL;
+		bool unproject = u->hardware_unprojector[0] && depth->data[0];
+
+		if(unproject && corrupt && u->pipeline.corrupt_policy == UNHVD_CORRUPT_REUSE)
+		{	//shared point cloud stays the last good one
+			unproject = false;
+			++u->stats_local.corrupt_sets_reused;
+		}
+
+		if(unproject && !unhvd_unprojectable(u, depth, texture))
+			unproject = false;
+
+		if(unproject)
+			if(unhvd_unproject_depth_frame(u, depth, texture) != UNHVD_OK)
+				break;
+
+		for(int i=0;i<u->decoders;++i)
+			if(u->pipeline.export_dmabuf[i] && u->pending[i]->data[0])
+				unhvd_export_frame(u, i);
+
+		if(u->pipeline.callback)
+			unhvd_call_callback(u, unproject);
+
+		if(u->recorder)
+		{	//sequence number is the number of sets published before, frames are moved by publishing
+			//point cloud buffer is swapped to shared one and stays unchanged until the next set
+			const unhvd_point_cloud pc = unhvd_point_cloud_view(&u->point_cloud[0]);
+
+			unhvd_recorder_record(u->recorder, u->stats_local.sets, u->pending, u->decoders,
+				unproject ? &pc : NULL, &u->stats_local);
+		}
+
+		if(first_set)
+		{	//time from first data of the session to first set (decoder resync)
+			const int ttff_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - session_start).count();
+
+			u->stats_local.time_to_first_set_us = ttff_us;
+			u->stats_local.time_to_first_set_max_us = max(u->stats_local.time_to_first_set_max_us, ttff_us);
+			first_set = false;
+		}
+
+		const int64_t pts = depth->pts; //pending frames are moved out by publishing
+
+		unhvd_publish_set(u, unproject);
+
+		if(u->recorder) //point cloud is copied after consumers got the set
+			unhvd_recorder_commit(u->recorder);
+
+		if(u->publisher && unproject)
+		{	//encoded after consumers got the set, only this thread swaps shared point cloud
+			const unhvd_point_cloud pc = unhvd_point_cloud_view(&u->point_cloud_shared[0]);
+
+			if(unhvd_publisher_publish(u->publisher, &pc, pts, &u->stats_local) != UNHVD_OK)
+				break;
+
+			unhvd_commit_stats(u);
 		}
 	}
 
+	{	//wake up consumers waiting for data (also on descriptor)
+		std::lock_guard<std::mutex> frame_guard(u->mutex);
+		u->finished = true;
+		u->stats = u->stats_local;
+#if defined(__linux__)
+		eventfd_write(u->event_fd, 1);
+#endif
+	}
+	u->new_data.notify_all();
+
 	if(u->keep_working)
 		cerr << "unhvd: network decoder fatal error" << endl;
 
 	cerr << "unhvd: network decoder thread finished" << endl;
 }
 
-static int unhvd_unproject_depth_frame(unhvd *u, const AVFrame *depth_frame, const AVFrame *texture_frame, hdu_point_cloud *pc)
+static int unhvd_receive(unhvd *u, AVFrame *frames[])
 {
-	if(depth_frame->linesize[0] / depth_frame->width != 2 ||
-		(depth_frame->format != AV_PIX_FMT_P010LE && depth_frame->format != AV_PIX_FMT_P016LE))
-		return UNHVD_ERROR_MSG("unhvd_unproject_depth_frame expects uint16 p010le/p016le data");
+#if defined(UNHVD_TESTING)
+	if(u->source)
+		return u->source(frames, u->source_user);
+#endif
+	return nhvd_receive(u->network_decoder, frames);
+}
 
-	if(texture_frame && texture_frame->data[0] &&
-		texture_frame->format != AV_PIX_FMT_RGB0 && texture_frame->format != AV_PIX_FMT_RGBA)
-		return UNHVD_ERROR_MSG("unhvd_unproject_depth_frame expects RGB0/RGBA texture data");
+//true if pending frames should be published, drops frames that will never be matched
+static bool unhvd_match_set(unhvd *u)
+{
+	if(!u->pipeline.sync)
+	{	//publish whatever was decoded
+		for(int i=0;i<u->decoders;++i)
+			if(u->pending[i]->data[0])
+				return true;
 
-	int size = depth_frame->width * depth_frame->height;
-	if(size != pc->size)
+		return false;
+	}
+
+	int64_t min_ts = INT64_MAX, max_ts = INT64_MIN;
+
+	for(int i=0;i<u->decoders;++i)
 	{
-		delete [] pc->data;
-		delete [] pc->colors;
-		pc->data = new float3[size];
-		pc->colors = new color32[size];
-		pc->size = size;
-		pc->used = 0;
+		if(!u->pending[i]->data[0])
+			return false; //incomplete set, wait for the rest
+
+		min_ts = min(min_ts, u->pending_ts[i]);
+		max_ts = max(max_ts, u->pending_ts[i]);
 	}
 
-	uint16_t *depth_data = (uint16_t*)depth_frame->data[0];
-	//texture data is optional
-	uint32_t *texture_data = texture_frame ? (uint32_t*)texture_frame->data[0] : NULL;
-	int texture_linesize = texture_frame ? texture_frame->linesize[0] : 0;
+	if(max_ts - min_ts <= u->pipeline.max_skew)
+		return true;
 
-	hdu_depth depth = {depth_data, texture_data, depth_frame->width, depth_frame->height,
-		depth_frame->linesize[0], texture_linesize};
-	//this could be moved to separate thread
-	hdu_unproject(u->hardware_unprojector, &depth, pc);
-	//zero out unused point cloud entries
-	memset(pc->data + pc->used, 0, (pc->size-pc->used)*sizeof(pc->data[0]));
-	memset(pc->colors + pc->used, 0, (pc->size-pc->used)*sizeof(pc->colors[0]));
+	//frames older than the newest one by more than max_skew have no chance of matching
+	for(int i=0;i<u->decoders;++i)
+		if(max_ts - u->pending_ts[i] > u->pipeline.max_skew)
+		{
+			av_frame_unref(u->pending[i]);
+			++u->stats_local.dropped;
+		}
 
-	return UNHVD_OK;
+	return false;
 }
 
-//NULL if there is no fresh data, non NULL otherwise
-int unhvd_get_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc)
+//decoder reported errors (e.g. missing slices after packet loss), data may be concealed
+static bool unhvd_frame_corrupt(const AVFrame *frame)
 {
-	if(u == NULL)
-		return UNHVD_ERROR;
-
-	u->mutex.lock();
-
-	bool new_data = false;
+	return (frame->flags & AV_FRAME_FLAG_CORRUPT) || frame->decode_error_flags;
+}
 
+//forget frames of previous session, new session may restart timestamps
+//decoders, point cloud buffers and publisher are kept warm
+static void unhvd_end_session(unhvd *u)
+{
 	for(int i=0;i<u->decoders;++i)
-		if(u->frame[i]->data[0] != NULL)
-			new_data = true;
+		if(u->pending[i]->data[0])
+		{	//unmatched frames will never be matched
+			av_frame_unref(u->pending[i]);
+			++u->stats_local.dropped;
+		}
+}
 
-	//for user convinience, return ERROR if there is no new data
-	if(!new_data)
-		return UNHVD_ERROR;
+//move pending frames to shared frames and swap point clouds
+static void unhvd_publish_set(unhvd *u, bool unprojected)
+{
+	{
+		std::lock_guard<std::mutex> frame_guard(u->mutex);
 
-	if(frame)
 		for(int i=0;i<u->decoders;++i)
-		{
-			frame[i].width = u->frame[i]->width;
-			frame[i].height = u->frame[i]->height;
-			frame[i].format = u->frame[i]->format;
+			if(u->pending[i]->data[0])
+			{
+				av_frame_unref(u->frame[i]);
+				av_frame_move_ref(u->frame[i], u->pending[i]);
+			}
 
-			//copy just a few ints and pointers, not the actual data
-			memcpy(frame[i].linesize, u->frame[i]->linesize, sizeof(frame[i].linesize));
-			memcpy(frame[i].data, u->frame[i]->data, sizeof(frame[i].data));
-		}
+		if(unprojected)
+			for(int l=0;l<UNHVD_MAX_LOD_LEVELS;++l)
+			{	//swap internal and shared point cloud (copy ints, pointers and summary)
+				unhvd_point_cloud_buffer temp = u->point_cloud_shared[l];
+				u->point_cloud_shared[l] = u->point_cloud[l];
+				u->point_cloud[l] = temp;
+			}
 
-	if(pc && u->hardware_unprojector)
-	{
-		//copy just two pointers and ints
-		pc->data = u->point_cloud_shared.data;
-		pc->colors = u->point_cloud_shared.colors;
-		pc->size = u->point_cloud_shared.size;
-		pc->used = u->point_cloud_shared.used;
+		++u->stats_local.sets;
+		u->stats_local.decoder_thread_cpu = unhvd_thread_cpu();
+		u->stats = u->stats_local;
+
+#if defined(__linux__)
+		eventfd_write(u->event_fd, 1);
+#endif
 	}
 
-	return UNHVD_OK;
+	u->new_data.notify_all();
 }
 
-//returns UNHVD_OK on success, UNHVD_ERROR on fatal error
-int unhvd_get_end(struct unhvd *u)
+//make decoding thread statistics visible to unhvd_get_stats when no set is published
+static void unhvd_commit_stats(unhvd *u)
 {
-	if(u == NULL)
-		return UNHVD_ERROR;
+	std::lock_guard<std::mutex> frame_guard(u->mutex);
+	u->stats = u->stats_local;
+}
 
-	for(int i=0;i<u->decoders;++i)
-		av_frame_unref(u->frame[i]);
+//replace pending frame with DRM PRIME frame, keep it as is if not possible
+static void unhvd_export_frame(unhvd *u, int decoder)
+{
+#if defined(__linux__)
+	AVFrame *pending = u->pending[decoder];
+	AVFrame *exported = u->exported[decoder];
 
-	u->mutex.unlock();
+	if(pending->format == AV_PIX_FMT_DRM_PRIME)
+	{	//already DRM PRIME frame
+		++u->stats_local.exported;
+		return;
+	}
 
-	return UNHVD_OK;
+	if(pending->hw_frames_ctx)
+	{
+		exported->format = AV_PIX_FMT_DRM_PRIME;
+
+		if(av_hwframe_map(exported, pending, AV_HWFRAME_MAP_READ) == 0)
+		{
+			av_frame_copy_props(exported, pending);
+			av_frame_unref(pending);
+			av_frame_move_ref(pending, exported);
+			++u->stats_local.exported;
+			return;
+		}
+
+		av_frame_unref(exported);
+	}
+	else if(u->pipeline.export_dmabuf[decoder] == UNHVD_EXPORT_MEMFD && unhvd_export_memfd(u, decoder))
+	{
+		++u->stats_local.exported;
+		return;
+	}
+#endif
+	//system memory frame or mapping failed, fall back to data
+	++u->stats_local.export_fallbacks;
 }
 
-int unhvd_get_frame_begin(unhvd *u, unhvd_frame *frame)
+#if defined(__linux__)
+//copy system memory frame to memfd backed buffer described as DRM PRIME frame
+static bool unhvd_export_memfd(unhvd *u, int decoder)
 {
-	return unhvd_get_begin(u, frame, NULL);
+	AVFrame *pending = u->pending[decoder];
+	AVFrame *exported = u->exported[decoder];
+	const uint32_t format = unhvd_drm_format(pending->format);
+
+	if(format == 0)
+		return false;
+
+	//planes packed in single object, 64 byte aligned
+	size_t offset[UNHVD_NUM_DATA_POINTERS], size = 0;
+	int planes = 0;
+
+	for(;planes<UNHVD_NUM_DATA_POINTERS && pending->data[planes] && pending->linesize[planes] > 0;++planes)
+	{
+		offset[planes] = size;
+		size += (size_t)pending->linesize[planes] * unhvd_plane_height(pending, planes);
+		size = (size + UNHVD_ALIGNMENT - 1) & ~(UNHVD_ALIGNMENT - 1);
+	}
+
+	unhvd_memfd_buffer *buf = unhvd_memfd_acquire(u, decoder, size);
+
+	if(buf == NULL)
+		return false;
+
+	AVDRMFrameDescriptor *desc = &buf->desc;
+	memset(desc, 0, sizeof(*desc));
+
+	desc->nb_objects = 1;
+	desc->objects[0].fd = buf->fd;
+	desc->objects[0].size = buf->size;
+	desc->objects[0].format_modifier = 0; //DRM_FORMAT_MOD_LINEAR
+	desc->nb_layers = 1;
+	desc->layers[0].format = format;
+	desc->layers[0].nb_planes = planes;
+
+	for(int p=0;p<planes;++p)
+	{
+		memcpy(buf->data + offset[p], pending->data[p], (size_t)pending->linesize[p] * unhvd_plane_height(pending, p));
+		desc->layers[0].planes[p].object_index = 0;
+		desc->layers[0].planes[p].offset = offset[p];
+		desc->layers[0].planes[p].pitch = pending->linesize[p];
+	}
+
+	//the buffer is released with the last reference of exported frame
+	if( (exported->buf[0] = av_buffer_create((uint8_t*)desc, sizeof(*desc), unhvd_memfd_release, buf, 0)) == NULL)
+	{
+		buf->in_use = false;
+		return false;
+	}
+
+	exported->data[0] = (uint8_t*)desc;
+	exported->format = AV_PIX_FMT_DRM_PRIME;
+	exported->width = pending->width;
+	exported->height = pending->height;
+	av_frame_copy_props(exported, pending);
+
+	av_frame_unref(pending);
+	av_frame_move_ref(pending, exported);
+
+	return true;
 }
 
-int unhvd_get_frame_end(struct unhvd *u)
+//released buffer of at least size or new one, NULL on failure
+static unhvd_memfd_buffer *unhvd_memfd_acquire(unhvd *u, int decoder, size_t size)
 {
-	return unhvd_get_end(u);
+	vector<unhvd_memfd_buffer*> &buffers = u->memfd_buffers[decoder];
+
+	for(size_t i=0;i<buffers.size();++i)
+		if(!buffers[i]->in_use && buffers[i]->size >= size)
+		{
+			buffers[i]->in_use = true;
+			return buffers[i];
+		}
+
+	//udmabuf needs page multiple size
+	const size_t page = sysconf(_SC_PAGESIZE);
+	unhvd_memfd_buffer *buf = new unhvd_memfd_buffer();
+
+	buf->fd = -1;
+	buf->data = NULL;
+	buf->size = (size + page - 1) / page * page;
+	buf->in_use = true;
+
+	if( (buf->memfd = memfd_create("unhvd-export", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1 ||
+		ftruncate(buf->memfd, buf->size) == -1 ||
+		(buf->data = (uint8_t*)mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->memfd, 0)) == MAP_FAILED)
+	{
+		buf->data = NULL;
+		unhvd_memfd_free(buf);
+		UNHVD_ERROR_MSG("failed to create memfd buffer for export");
+		return NULL;
+	}
+
+	buf->fd = buf->memfd;
+
+	if(u->udmabuf != -1 && fcntl(buf->memfd, F_ADD_SEALS, F_SEAL_SHRINK) == 0)
+	{
+		udmabuf_create create;
+		memset(&create, 0, sizeof(create));
+		create.memfd = buf->memfd;
+		create.flags = UDMABUF_FLAGS_CLOEXEC;
+		create.offset = 0;
+		create.size = buf->size;
+
+		const int dmabuf = ioctl(u->udmabuf, UDMABUF_CREATE, &create);
+
+		if(dmabuf != -1)
+			buf->fd = dmabuf;
+	}
+
+	buffers.push_back(buf);
+
+	return buf;
 }
 
-int unhvd_get_point_cloud_begin(unhvd *u, unhvd_point_cloud *pc)
+//called by whichever thread releases the last reference
+static void unhvd_memfd_release(void *opaque, uint8_t *data)
 {
-	return unhvd_get_begin(u, NULL, pc);
+	unhvd_memfd_buffer *buf = (unhvd_memfd_buffer*)opaque;
+	buf->in_use = false;
 }
 
-int unhvd_get_point_cloud_end(unhvd *u)
+static void unhvd_memfd_free(unhvd_memfd_buffer *buf)
 {
-	return unhvd_get_end(u);
+	if(buf->data)
+		munmap(buf->data, buf->size);
+	if(buf->fd != -1 && buf->fd != buf->memfd)
+		close(buf->fd);
+	if(buf->memfd != -1)
+		close(buf->memfd);
+
+	delete buf;
 }
 
-static unhvd *unhvd_close_and_return_null(unhvd *u, const char *msg)
+static inline uint32_t unhvd_fourcc(char a, char b, char c, char d)
 {
-	if(msg)
-		cerr << "unhvd: " << msg << endl;
+	return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
 
-	unhvd_close(u);
+//DRM fourcc of system memory pixel format, 0 if not supported
+static uint32_t unhvd_drm_format(int format)
+{
+	switch(format)
+	{
+		case AV_PIX_FMT_NV12: return unhvd_fourcc('N', 'V', '1', '2');
+		case AV_PIX_FMT_P010LE: return unhvd_fourcc('P', '0', '1', '0');
+		case AV_PIX_FMT_P016LE: return unhvd_fourcc('P', '0', '1', '6');
+		case AV_PIX_FMT_YUV420P: return unhvd_fourcc('Y', 'U', '1', '2');
+		case AV_PIX_FMT_RGB0: return unhvd_fourcc('X', 'B', '2', '4');
+		case AV_PIX_FMT_RGBA: return unhvd_fourcc('A', 'B', '2', '4');
+		case AV_PIX_FMT_GRAY8: return unhvd_fourcc('R', '8', ' ', ' ');
+	}
 
-	return NULL;
+	return 0;
 }
 
-void unhvd_close(unhvd *u)
-{	//free mutex?
-	if(u == NULL)
-		return;
+//chroma planes of planar formats are subsampled vertically
+static int unhvd_plane_height(const AVFrame *frame, int plane)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
 
-	u->keep_working=false;
-	if(u->network_thread.joinable())
-		u->network_thread.join();
+	if(desc == NULL || (plane != 1 && plane != 2))
+		return frame->height;
+
+	return (frame->height + (1 << desc->log2_chroma_h) - 1) >> desc->log2_chroma_h;
+}
+#endif
 
-	nhvd_close(u->network_decoder);
+//lend pending set to the user, account callback time
+static void unhvd_call_callback(unhvd *u, bool unprojected)
+{
+	unhvd_frame frame[UNHVD_MAX_DECODERS];
+	unhvd_frame_info info[UNHVD_MAX_DECODERS];
+	const unhvd_point_cloud pc = unhvd_point_cloud_view(&u->point_cloud[0]);
 
 	for(int i=0;i<u->decoders;++i)
+	{
+		unhvd_fill_frame(&frame[i], u->pending[i]);
+		unhvd_fill_frame_info(&info[i], u->pending[i]);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	u->pipeline.callback(frame, info, u->decoders, unprojected ? &pc : NULL, u->pipeline.callback_user);
+
+	const int elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	unhvd_stats *stats = &u->stats_local;
+
+	++stats->callbacks;
+	stats->callback_max_us = max(stats->callback_max_us, elapsed_us);
+
+	if(u->pipeline.callback_budget_us && elapsed_us > u->pipeline.callback_budget_us)
+		++stats->callback_overruns;
+}
+
+//malformed frames are not unprojected (but still published), decoding continues
+static bool unhvd_unprojectable(unhvd *u, const AVFrame *depth_frame, const AVFrame *texture_frame)
+{
+	const char *error = unhvd_validate_frames(depth_frame, texture_frame);
+
+	if(error == NULL)
+		return true;
+
+	//report only the first one, the stream is likely malformed until reconfigured
+	if(u->stats_local.unproject_rejected++ == 0)
+		UNHVD_ERROR_MSG(error);
+
+	return false;
+}
+
+//NULL if frames can be unprojected, error message otherwise
+//strides may be padded, frames are accessed row by row
+static const char *unhvd_validate_frames(const AVFrame *depth_frame, const AVFrame *texture_frame)
+{
+	if(depth_frame->format != AV_PIX_FMT_P010LE && depth_frame->format != AV_PIX_FMT_P016LE)
+		return "unhvd_unproject_depth_frame expects uint16 p010le/p016le data";
+
+	if(depth_frame->width <= 0 || depth_frame->height <= 0 ||
+		depth_frame->linesize[0] < depth_frame->width * (int)sizeof(uint16_t) ||
+		depth_frame->linesize[0] % sizeof(uint16_t))
+		return "unhvd_unproject_depth_frame got depth frame with invalid size or stride";
+
+	if(texture_frame == NULL || texture_frame->data[0] == NULL)
+		return NULL; //texture data is optional
+
+	if(texture_frame->format != AV_PIX_FMT_RGB0 && texture_frame->format != AV_PIX_FMT_RGBA)
+		return "unhvd_unproject_depth_frame expects RGB0/RGBA texture data";
+
+	//texture is indexed with depth pixel coordinates
+	if(texture_frame->width < depth_frame->width || texture_frame->height < depth_frame->height ||
+		texture_frame->linesize[0] < depth_frame->width * (int)sizeof(uint32_t) ||
+		texture_frame->linesize[0] % sizeof(uint32_t))
+		return "unhvd_unproject_depth_frame expects texture at least the size of depth frame";
+
+	return NULL;
+}
+
+//frames have to be validated with unhvd_validate_frames
+static int unhvd_unproject_depth_frame(unhvd *u, const AVFrame *depth_frame, const AVFrame *texture_frame)
+{
+	//region of interest clipped to the frame, pixels outside are never touched
+	const unhvd_depth_ext_config *ext = &u->depth.ext;
+	const int x = min(ext->roi_x, depth_frame->width);
+	const int y = min(ext->roi_y, depth_frame->height);
+	const int width = ext->roi_width ? min(ext->roi_width, depth_frame->width - x) : depth_frame->width - x;
+	const int height = ext->roi_height ? min(ext->roi_height, depth_frame->height - y) : depth_frame->height - y;
+
+	uint16_t *depth_data = (uint16_t*)(depth_frame->data[0] + y * depth_frame->linesize[0]) + x;
+	//texture data is optional
+	uint32_t *texture_data = texture_frame && texture_frame->data[0] ?
+		(uint32_t*)(texture_frame->data[0] + y * texture_frame->linesize[0]) + x : NULL;
+	int texture_linesize = texture_data ? texture_frame->linesize[0] : 0;
+
+	//the unprojector principal point is already shifted by region of interest offset
+	hdu_depth depth = {depth_data, texture_data, width, height,
+		depth_frame->linesize[0], texture_linesize};
+
+	if(unhvd_unproject_level(u, 0, &depth) != UNHVD_OK)
+		return UNHVD_ERROR;
+
+	//each level is decimated from the previous one and unprojected in its own pass
+	for(int l=1;l<UNHVD_MAX_LOD_LEVELS;++l)
+	{
+		if(!u->hardware_unprojector[l])
+		{	//level not configured, consumer gets empty point cloud with no stale data
+			unhvd_point_cloud_buffer *buf = &u->point_cloud[l];
+			const int dirty = min(buf->dirty, buf->capacity); //all of it, size may grow later
+
+			if(dirty > 0)
+			{
+				memset(buf->pc.data, 0, dirty * sizeof(buf->pc.data[0]));
+				memset(buf->pc.colors, 0, dirty * sizeof(buf->pc.colors[0]));
+			}
+
+			buf->pc.used = buf->dirty = 0;
+			buf->has_summary = false;
+			continue;
+		}
+
+		hdu_depth decimated;
+		unhvd_decimate(&depth, ext->lod_method, &u->lod[l], &decimated);
+		depth = decimated;
+
+		if(unhvd_unproject_level(u, l, &depth) != UNHVD_OK)
+			return UNHVD_ERROR;
+	}
+
+	return UNHVD_OK;
+}
+
+static int unhvd_unproject_level(unhvd *u, int level, const hdu_depth *depth)
+{
+	const unhvd_depth_state *d = &u->depth;
+	unhvd_point_cloud_buffer *buf = &u->point_cloud[level];
+
+	if(unhvd_point_cloud_reserve(u, buf, depth->width * depth->height) != UNHVD_OK)
+		return UNHVD_ERROR_MSG("not enough memory for point cloud");
+
+	hdu_point_cloud *pc = &buf->pc;
+
+	pc->used = 0;
+	buf->has_summary = d->ext.summary != 0;
+
+	const bool reduce = d->box_culling || buf->has_summary;
+	unhvd_reduction r = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}, {0.0, 0.0, 0.0}, FLT_MAX, 0};
+
+	memset(&buf->summary, 0, sizeof(buf->summary));
+
+	//this could be moved to separate thread
+	//hdu_unproject rules (margins, axes, colors) apply, culling and summary are done
+	//on points of band while in cache, without another pass over point cloud
+	for(int y=0;depth->width > 0 && y<depth->height;y+=UNHVD_BAND_ROWS)
+	{
+		hdu *h = unhvd_band_unprojector(u, level, y / UNHVD_BAND_ROWS);
+
+		if(h == NULL)
+			return UNHVD_ERROR_MSG("failed to initialize hardware unprojector for band");
+
+		hdu_depth band = {(uint16_t*)((uint8_t*)depth->data + y * depth->depth_stride),
+			depth->colors ? (uint32_t*)((uint8_t*)depth->colors + y * depth->colors_stride) : NULL,
+			depth->width, min(UNHVD_BAND_ROWS, depth->height - y), depth->depth_stride, depth->colors_stride};
+
+		hdu_point_cloud band_pc = {pc->data + pc->used, pc->colors + pc->used, pc->size - pc->used, 0};
+
+		hdu_unproject(h, &band, &band_pc);
+
+		pc->used += reduce ? unhvd_cull_reduce(d, &band_pc, &r, &buf->summary) : band_pc.used;
+	}
+
+	if(buf->has_summary)
+		unhvd_reduction_finish(d, &r, &buf->summary);
+
+	//zero out unused point cloud entries, only those used before are not zero already
+	const int dirty = min(buf->dirty, pc->size);
+
+	if(dirty > pc->used)
+	{
+		memset(pc->data + pc->used, 0, (dirty-pc->used)*sizeof(pc->data[0]));
+		memset(pc->colors + pc->used, 0, (dirty-pc->used)*sizeof(pc->colors[0]));
+	}
+
+	buf->dirty = buf->dirty > pc->size ? buf->dirty : pc->used;
+
+	return UNHVD_OK;
+}
+
+//select index of one of 4 depth samples (0 is invalid), -1 if none is valid
+static inline int unhvd_select(const uint16_t v[4], int method)
+{
+	int valid[4], n = 0;
+
+	for(int i=0;i<4;++i)
+		if(v[i])
+			valid[n++] = i;
+
+	if(n == 0 || method == UNHVD_LOD_NEAREST_VALID)
+		return n ? valid[0] : -1;
+
+	//insertion sort of up to 4 indices by depth
+	for(int i=1;i<n;++i)
+		for(int j=i;j>0 && v[valid[j]] < v[valid[j-1]];--j)
+			swap(valid[j], valid[j-1]);
+
+	//lower median keeps real sample (and its color)
+	return method == UNHVD_LOD_MIN ? valid[0] : valid[(n - 1) / 2];
+}
+
+//halve depth (and texture) resolution selecting one sample of each 2x2 block
+static void unhvd_decimate(const hdu_depth *src, int method, unhvd_lod_buffer *lod, hdu_depth *dst)
+{
+	const int width = src->width / 2;
+	const int height = src->height / 2;
+	const bool colors = src->colors != NULL;
+
+	//grow only, no allocation in steady state
+	if(lod->depth.size() < (size_t)width * height)
+		lod->depth.resize(width * height);
+	if(colors && lod->colors.size() < (size_t)width * height)
+		lod->colors.resize(width * height);
+
+	for(int r=0;r<height;++r)
+	{
+		const uint16_t *d0 = (const uint16_t*)((const uint8_t*)src->data + 2 * r * src->depth_stride);
+		const uint16_t *d1 = (const uint16_t*)((const uint8_t*)d0 + src->depth_stride);
+		const uint32_t *c0 = colors ? (const uint32_t*)((const uint8_t*)src->colors + 2 * r * src->colors_stride) : NULL;
+		const uint32_t *c1 = colors ? (const uint32_t*)((const uint8_t*)c0 + src->colors_stride) : NULL;
+
+		uint16_t *depth = lod->depth.data() + r * width;
+		uint32_t *color = colors ? lod->colors.data() + r * width : NULL;
+
+		for(int c=0;c<width;++c)
+		{
+			const uint16_t v[4] = {d0[2*c], d0[2*c+1], d1[2*c], d1[2*c+1]};
+			const int i = unhvd_select(v, method);
+
+			depth[c] = i < 0 ? 0 : v[i];
+
+			if(colors)
+			{
+				const uint32_t t[4] = {c0[2*c], c0[2*c+1], c1[2*c], c1[2*c+1]};
+				color[c] = i < 0 ? 0 : t[i];
+			}
+		}
+	}
+
+	hdu_depth result = {lod->depth.data(), colors ? lod->colors.data() : NULL, width, height,
+		(int)(width * sizeof(uint16_t)), colors ? (int)(width * sizeof(uint32_t)) : 0};
+
+	*dst = result;
+}
+
+//validate configuration, prepare unprojector and internal copy of configuration
+static int unhvd_depth_prepare(const unhvd_depth_config *dc, const unhvd_depth_ext_config *ext,
+	hdu *h[UNHVD_MAX_LOD_LEVELS], unhvd_depth_state *d)
+{
+	const unhvd_depth_ext_config no_ext = unhvd_depth_ext_config();
+
+	if(ext == NULL)
+		ext = &no_ext;
+
+	if(ext->roi_x < 0 || ext->roi_y < 0 || ext->roi_width < 0 || ext->roi_height < 0)
+		return UNHVD_ERROR_MSG("region of interest has to be non negative");
+
+	if(ext->box_half_size[0] < 0.0f || ext->box_half_size[1] < 0.0f || ext->box_half_size[2] < 0.0f)
+		return UNHVD_ERROR_MSG("culling box half sizes have to be non negative");
+
+	if(ext->lod_levels < 0 || ext->lod_levels >= UNHVD_MAX_LOD_LEVELS)
+		return UNHVD_ERROR_MSG("lod_levels out of range");
+
+	if(ext->lod_method < UNHVD_LOD_MIN || ext->lod_method > UNHVD_LOD_NEAREST_VALID)
+		return UNHVD_ERROR_MSG("invalid lod_method");
+
+	d->config = *dc;
+	d->ext = *ext;
+	d->box_culling = ext->box_half_size[0] > 0.0f || ext->box_half_size[1] > 0.0f || ext->box_half_size[2] > 0.0f;
+
+	//partially specified box is unbounded along axes with 0 half size
+	for(int k=0;k<3;++k)
+		if(d->ext.box_half_size[k] == 0.0f)
+			d->ext.box_half_size[k] = FLT_MAX;
+
+	bool axis_aligned = true;
+	for(int i=0;i<9;++i)
+		if(ext->box_rotation[i] != 0.0f)
+			axis_aligned = false;
+
+	if(axis_aligned)
+	{
+		const float identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+		memcpy(d->ext.box_rotation, identity, sizeof(identity));
+	}
+
+	for(int l=0;l<UNHVD_MAX_LOD_LEVELS;++l)
+		h[l] = NULL;
+
+	for(int l=0;l<=ext->lod_levels;++l)
+		if( (h[l] = unhvd_hdu_init(d, l)) == NULL )
+		{
+			unhvd_hdu_close(h);
+			return UNHVD_ERROR_MSG("failed to initialize hardware unprojector");
+		}
+
+	return UNHVD_OK;
+}
+
+int unhvd_set_depth_config(unhvd *u, const unhvd_depth_config *depth_config,
+	const unhvd_depth_ext_config *depth_ext)
+{
+	if(u == NULL || depth_config == NULL)
+		return UNHVD_ERROR;
+
+	if(!u->depth_enabled)
+		return UNHVD_ERROR_MSG("unhvd_set_depth_config requires depth config in unhvd_init");
+
+	hdu *h[UNHVD_MAX_LOD_LEVELS];
+	unhvd_depth_state depth;
+
+	//the expensive part is done here, outside of the decoding thread
+	if(unhvd_depth_prepare(depth_config, depth_ext, h, &depth) != UNHVD_OK)
+		return UNHVD_ERROR;
+
+	std::lock_guard<std::mutex> config_guard(u->config_mutex);
+
+	//replace configuration that was not applied yet
+	unhvd_hdu_close(u->staged_unprojector);
+
+	memcpy(u->staged_unprojector, h, sizeof(h));
+	u->staged_depth = depth;
+	u->staged = true;
+
+	return UNHVD_OK;
+}
+
+//called by network decoder thread between frames
+static void unhvd_apply_staged_config(unhvd *u)
+{
+	hdu *old[UNHVD_MAX_LOD_LEVELS];
+
+	{
+		std::lock_guard<std::mutex> config_guard(u->config_mutex);
+
+		memcpy(old, u->hardware_unprojector, sizeof(old));
+		memcpy(u->hardware_unprojector, u->staged_unprojector, sizeof(old));
+		u->depth = u->staged_depth;
+
+		memset(u->staged_unprojector, 0, sizeof(old));
+		u->staged = false;
+	}
+
+	unhvd_hdu_close(old);
+	unhvd_band_close(u);
+}
+
+//unprojector for region of interest has principal point in region coordinates
+//level of detail pixel (u, v) covers s x s block of pixels starting at (s*u, s*v)
+static hdu_config unhvd_hdu_config(const unhvd_depth_state *d, int level)
+{
+	const unhvd_depth_config *dc = &d->config;
+	const float s = (float)(1 << level);
+	const float offset = (s - 1.0f) / 2.0f; //block center relative to its first pixel
+
+	const hdu_config hdu_cfg = {(dc->ppx - d->ext.roi_x - offset) / s, (dc->ppy - d->ext.roi_y - offset) / s,
+		dc->fx / s, dc->fy / s, dc->depth_unit, dc->min_margin, dc->max_margin};
+
+	return hdu_cfg;
+}
+
+static hdu *unhvd_hdu_init(const unhvd_depth_state *d, int level)
+{
+	const hdu_config hdu_cfg = unhvd_hdu_config(d, level);
+
+	return hdu_init(&hdu_cfg);
+}
+
+//unprojector of band, band 0 is the level unprojector
+static hdu *unhvd_band_unprojector(unhvd *u, int level, int band)
+{
+	if(band == 0)
+		return u->hardware_unprojector[level];
+
+	vector<hdu*> &bands = u->band_unprojector[level];
+
+	if(bands.size() <= (size_t)band)
+		bands.resize(band + 1, NULL);
+
+	if(bands[band] == NULL)
+	{	//band pixel (x, y) is pixel (x, y + band * rows) of level
+		hdu_config hdu_cfg = unhvd_hdu_config(&u->depth, level);
+		hdu_cfg.ppy -= band * UNHVD_BAND_ROWS;
+
+		bands[band] = hdu_init(&hdu_cfg);
+	}
+
+	return bands[band];
+}
+
+static void unhvd_band_close(unhvd *u)
+{
+	for(int l=0;l<UNHVD_MAX_LOD_LEVELS;++l)
+		for(size_t b=0;b<u->band_unprojector[l].size();++b)
+		{
+			hdu_close(u->band_unprojector[l][b]);
+			u->band_unprojector[l][b] = NULL;
+		}
+}
+
+//box culling and reductions over kept points of unprojected band,
+//kept points are moved to the front of band, returns their number
+static int unhvd_cull_reduce(const unhvd_depth_state *d, hdu_point_cloud *band, unhvd_reduction *r, unhvd_point_cloud_summary *s)
+{
+	const unhvd_depth_ext_config *ext = &d->ext;
+	const bool cull = d->box_culling;
+	const bool summary = ext->summary != 0;
+	const float *c = ext->box_center;
+	const float *h = ext->box_half_size;
+	const float *m = ext->box_rotation;
+
+	const float hmin = ext->histogram_min;
+	const float bin_scale = ext->histogram_max > hmin ? UNHVD_HISTOGRAM_BINS / (ext->histogram_max - hmin) : 0.0f;
+
+	int kept = 0;
+
+	for(int i=0;i<band->used;++i)
+	{
+		const float *p = band->data[i];
+
+		if(cull)
+		{	//box coordinates R^T (p - c), columns of row major R
+			const float dx = p[0] - c[0], dy = p[1] - c[1], dz = p[2] - c[2];
+
+			if(fabsf(m[0]*dx + m[3]*dy + m[6]*dz) > h[0] ||
+				fabsf(m[1]*dx + m[4]*dy + m[7]*dz) > h[1] ||
+				fabsf(m[2]*dx + m[5]*dy + m[8]*dz) > h[2])
+				continue;
+		}
+
+		if(summary)
+		{
+			for(int k=0;k<3;++k)
+			{
+				r->lo[k] = min(r->lo[k], p[k]);
+				r->hi[k] = max(r->hi[k], p[k]);
+				r->sum[k] += p[k];
+			}
+
+			r->nearest = min(r->nearest, p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+
+			if(bin_scale > 0.0f)
+			{
+				const float bin = (p[2] - hmin) * bin_scale;
+				++s->histogram[bin <= 0.0f ? 0 : bin >= UNHVD_HISTOGRAM_BINS ? UNHVD_HISTOGRAM_BINS - 1 : (int)bin];
+			}
+		}
+
+		if(kept != i)
+		{
+			memcpy(band->data[kept], p, sizeof(float3));
+			band->colors[kept] = band->colors[i];
+		}
+
+		++kept;
+	}
+
+	r->kept += kept;
+
+	return kept;
+}
+
+static void unhvd_reduction_finish(const unhvd_depth_state *d, const unhvd_reduction *r, unhvd_point_cloud_summary *s)
+{
+	if(r->kept == 0)
+		return;
+
+	for(int k=0;k<3;++k)
+	{
+		s->min[k] = r->lo[k];
+		s->max[k] = r->hi[k];
+		s->centroid[k] = (float)(r->sum[k] / r->kept);
+	}
+
+	s->nearest = sqrtf(r->nearest);
+
+	if(d->ext.histogram_max > d->ext.histogram_min)
+	{
+		s->histogram_min = d->ext.histogram_min;
+		s->histogram_max = d->ext.histogram_max;
+	}
+}
+
+//grow point cloud storage if needed, no allocation in steady state
+static int unhvd_point_cloud_reserve(unhvd *u, unhvd_point_cloud_buffer *buf, int size)
+{
+	hdu_point_cloud *pc = &buf->pc;
+
+	if(size > buf->capacity)
+	{
+		unhvd_point_cloud_free(buf);
+
+		pc->data = (float3*)unhvd_aligned_alloc(size * sizeof(float3));
+		pc->colors = (color32*)unhvd_aligned_alloc(size * sizeof(color32));
+
+		if(!pc->data || !pc->colors)
+		{
+			unhvd_point_cloud_free(buf);
+			return UNHVD_ERROR;
+		}
+
+		buf->capacity = size;
+		buf->dirty = size; //not zero initialized
+		++u->stats_local.point_cloud_allocations;
+	}
+
+	if(size != pc->size)
+	{
+		pc->size = size;
+		pc->used = 0;
+	}
+
+	return UNHVD_OK;
+}
+
+static void unhvd_point_cloud_free(unhvd_point_cloud_buffer *buf)
+{
+	unhvd_aligned_free(buf->pc.data);
+	unhvd_aligned_free(buf->pc.colors);
+	buf->pc = hdu_point_cloud();
+	buf->capacity = buf->dirty = 0;
+	buf->has_summary = false;
+}
+
+//64 byte aligned, large buffers are aligned and advised for huge pages
+static void *unhvd_aligned_alloc(size_t size)
+{
+	const size_t alignment = size >= UNHVD_HUGE_PAGE_SIZE ? UNHVD_HUGE_PAGE_SIZE : UNHVD_ALIGNMENT;
+	void *ptr = NULL;
+
+#if defined(_WIN32)
+	ptr = _aligned_malloc(size, alignment);
+#else
+	if(posix_memalign(&ptr, alignment, size) != 0)
+		return NULL;
+#endif
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if(alignment == UNHVD_HUGE_PAGE_SIZE)
+		madvise(ptr, size - size % UNHVD_HUGE_PAGE_SIZE, MADV_HUGEPAGE); //only a hint
+#endif
+
+	return ptr;
+}
+
+static void unhvd_aligned_free(void *ptr)
+{
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+//NULL if there is no fresh data, non NULL otherwise
+//the mutex stays locked on return (also with UNHVD_ERROR), unhvd_get_end unlocks it
+int unhvd_get_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc)
+{
+	if(u == NULL)
+		return UNHVD_ERROR;
+
+	u->mutex.lock();
+
+	return unhvd_fill_begin(u, frame, pc, 0);
+}
+
+int unhvd_wait_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc, int timeout_ms)
+{
+	if(u == NULL)
+		return UNHVD_ERROR;
+
+	std::unique_lock<std::mutex> lock(u->mutex);
+
+	u->new_data.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+		[u]{ return u->finished || unhvd_new_data(u); });
+
+	//the mutex is unlocked in unhvd_get_end
+	lock.release();
+
+	return unhvd_fill_begin(u, frame, pc, 0);
+}
+
+int unhvd_get_stats(unhvd *u, unhvd_stats *stats)
+{
+	if(u == NULL || stats == NULL)
+		return UNHVD_ERROR;
+
+	std::lock_guard<std::mutex> frame_guard(u->mutex);
+	*stats = u->stats;
+
+	return UNHVD_OK;
+}
+
+int unhvd_get_fd(unhvd *u)
+{
+	return u ? u->event_fd : -1;
+}
+
+//called with mutex held
+static bool unhvd_new_data(const unhvd *u)
+{
+	for(int i=0;i<u->decoders;++i)
+		if(u->frame[i]->data[0] != NULL)
+			return true;
+
+	return false;
+}
+
+//called with mutex held, the mutex is unlocked in unhvd_get_end
+static int unhvd_fill_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc, int level)
+{
+#if defined(__linux__)
+	eventfd_t value; //consume notification, new data is returned now
+	//after decoding thread finished descriptor stays readable, retrieval returns UNHVD_ERROR
+	if(!u->finished)
+		eventfd_read(u->event_fd, &value);
+#endif
+
+	//for user convinience, return ERROR if there is no new data
+	if(!unhvd_new_data(u))
+		return UNHVD_ERROR;
+
+	if(frame)
+		for(int i=0;i<u->decoders;++i)
+			unhvd_fill_frame(&frame[i], u->frame[i]);
+
+	if(pc && u->depth_enabled)
+		*pc = unhvd_point_cloud_view(&u->point_cloud_shared[level]);
+
+	return UNHVD_OK;
+}
+
+static void unhvd_fill_frame(unhvd_frame *frame, const AVFrame *av)
+{
+	frame->width = av->width;
+	frame->height = av->height;
+	frame->format = av->format;
+
+#if defined(__linux__)
+	if(av->format == AV_PIX_FMT_DRM_PRIME)
+	{	//exported frame is described by unhvd_frame_info::dmabuf
+		memset(frame->linesize, 0, sizeof(frame->linesize));
+		memset(frame->data, 0, sizeof(frame->data));
+		return;
+	}
+#endif
+
+	//copy just a few ints and pointers, not the actual data
+	memcpy(frame->linesize, av->linesize, sizeof(frame->linesize));
+	memcpy(frame->data, av->data, sizeof(frame->data));
+}
+
+static void unhvd_fill_frame_info(unhvd_frame_info *info, const AVFrame *av)
+{
+	info->pts = av->pts;
+	info->fresh = av->data[0] != NULL;
+	info->corrupt = av->data[0] && unhvd_frame_corrupt(av);
+
+	memset(&info->dmabuf, 0, sizeof(info->dmabuf));
+
+#if defined(__linux__)
+	if(av->format == AV_PIX_FMT_DRM_PRIME && av->data[0])
+	{	//data[0] of DRM PRIME frame holds the descriptor, flatten layers
+		const AVDRMFrameDescriptor *desc = (const AVDRMFrameDescriptor*)av->data[0];
+		unhvd_dmabuf *dmabuf = &info->dmabuf;
+
+		dmabuf->objects = min(desc->nb_objects, (int)UNHVD_MAX_DMABUF_OBJECTS);
+
+		for(int i=0;i<dmabuf->objects;++i)
+		{
+			dmabuf->fd[i] = desc->objects[i].fd;
+			dmabuf->size[i] = desc->objects[i].size;
+			dmabuf->modifier[i] = desc->objects[i].format_modifier;
+		}
+
+		for(int l=0;l<desc->nb_layers;++l)
+			for(int p=0;p<desc->layers[l].nb_planes && dmabuf->planes < UNHVD_MAX_DMABUF_PLANES;++p)
+			{
+				const AVDRMPlaneDescriptor *plane = &desc->layers[l].planes[p];
+				dmabuf->format[dmabuf->planes] = desc->layers[l].format;
+				dmabuf->object[dmabuf->planes] = plane->object_index;
+				dmabuf->offset[dmabuf->planes] = plane->offset;
+				dmabuf->pitch[dmabuf->planes] = plane->pitch;
+				++dmabuf->planes;
+			}
+	}
+#endif
+}
+
+//copy just a few pointers and ints
+static unhvd_point_cloud unhvd_point_cloud_view(const unhvd_point_cloud_buffer *buf)
+{
+	const hdu_point_cloud *pc = &buf->pc;
+	unhvd_point_cloud view = {pc->data, pc->colors, pc->size, pc->used};
+	return view;
+}
+
+//returns UNHVD_OK on success, UNHVD_ERROR on fatal error
+int unhvd_get_end(struct unhvd *u)
+{
+	if(u == NULL)
+		return UNHVD_ERROR;
+
+	for(int i=0;i<u->decoders;++i)
+		av_frame_unref(u->frame[i]);
+
+	u->mutex.unlock();
+
+	return UNHVD_OK;
+}
+
+int unhvd_get_frame_begin(unhvd *u, unhvd_frame *frame)
+{
+	return unhvd_get_begin(u, frame, NULL);
+}
+
+int unhvd_get_frame_end(struct unhvd *u)
+{
+	return unhvd_get_end(u);
+}
+
+int unhvd_get_point_cloud_begin(unhvd *u, unhvd_point_cloud *pc)
+{
+	return unhvd_get_begin(u, NULL, pc);
+}
+
+int unhvd_get_point_cloud_level_begin(unhvd *u, int level, unhvd_point_cloud *pc)
+{
+	if(u == NULL)
+		return UNHVD_ERROR;
+
+	u->mutex.lock();
+
+	if(level < 0 || level >= UNHVD_MAX_LOD_LEVELS)
+		return UNHVD_ERROR_MSG("point cloud level out of range");
+
+	return unhvd_fill_begin(u, NULL, pc, level);
+}
+
+int unhvd_get_point_cloud_end(unhvd *u)
+{
+	return unhvd_get_end(u);
+}
+
+//called between begin and end, the mutex is already held
+int unhvd_get_frame_info(unhvd *u, unhvd_frame_info *info)
+{
+	if(u == NULL || info == NULL)
+		return UNHVD_ERROR;
+
+	for(int i=0;i<u->decoders;++i)
+		unhvd_fill_frame_info(&info[i], u->frame[i]);
+
+	return UNHVD_OK;
+}
+
+//called between begin and end, the mutex is already held
+int unhvd_get_point_cloud_summary(unhvd *u, int level, unhvd_point_cloud_summary *summary)
+{
+	if(u == NULL || summary == NULL || level < 0 || level >= UNHVD_MAX_LOD_LEVELS)
+		return UNHVD_ERROR;
+
+	if(!u->depth_enabled || !u->point_cloud_shared[level].has_summary)
+		return UNHVD_ERROR;
+
+	*summary = u->point_cloud_shared[level].summary;
+
+	return UNHVD_OK;
+}
+
+static unhvd *unhvd_close_and_return_null(unhvd *u, const char *msg)
+{
+	if(msg)
+		cerr << "unhvd: " << msg << endl;
+
+	unhvd_close(u);
+
+	return NULL;
+}
+
+void unhvd_close(unhvd *u)
+{	//free mutex?
+	if(u == NULL)
+		return;
+
+	u->keep_working=false;
+	if(u->network_thread.joinable())
+		u->network_thread.join();
+
+	if(u->network_decoder && u->pipeline.keep_warm)
+	{	//parked for the next init with the same configuration
+		unhvd_warm_decoder warm = {u->network_decoder, u->warm_key, u->warm_port};
+		std::lock_guard<std::mutex> warm_guard(unhvd_warm_mutex);
+		unhvd_warm_pool.push_back(warm);
+	}
+	else
+		nhvd_close(u->network_decoder);
+
+	unhvd_publisher_close(u->publisher);
+	unhvd_recorder_close(u->recorder);
+
+	for(int i=0;i<u->decoders;++i)
+	{
 		av_frame_free(&u->frame[i]);
+		av_frame_free(&u->pending[i]);
+		av_frame_free(&u->exported[i]);
+	}
+
+#if defined(__linux__)
+	//all frames are released, so are exported buffers
+	for(int i=0;i<UNHVD_MAX_DECODERS;++i)
+		for(size_t b=0;b<u->memfd_buffers[i].size();++b)
+			unhvd_memfd_free(u->memfd_buffers[i][b]);
+
+	if(u->udmabuf != -1)
+		close(u->udmabuf);
+
+	if(u->event_fd != -1)
+		close(u->event_fd);
+#endif
 
-	hdu_close(u->hardware_unprojector);
-	delete [] u->point_cloud.data;
-	delete [] u->point_cloud.colors;
-	delete [] u->point_cloud_shared.data;
-	delete [] u->point_cloud_shared.colors;
+	unhvd_hdu_close(u->hardware_unprojector);
+	unhvd_hdu_close(u->staged_unprojector);
+	unhvd_band_close(u);
+
+	for(int l=0;l<UNHVD_MAX_LOD_LEVELS;++l)
+	{
+		unhvd_point_cloud_free(&u->point_cloud[l]);
+		unhvd_point_cloud_free(&u->point_cloud_shared[l]);
+	}
 
 	delete u;
 }
 
+void unhvd_warm_pool_clear()
+{
+	std::lock_guard<std::mutex> warm_guard(unhvd_warm_mutex);
+
+	for(size_t i=0;i<unhvd_warm_pool.size();++i)
+		nhvd_close(unhvd_warm_pool[i].network_decoder);
+
+	unhvd_warm_pool.clear();
+}
+
+//the same key means nhvd_init would get identical configuration
+static string unhvd_warm_key(const unhvd_net_config *net_config, const unhvd_hw_config *hw_config, int hw_size)
+{
+	string key;
+	//NULL strings differ from empty, separator is not expected in configuration
+	const char *strings[4];
+
+	key += net_config->ip ? string("+") + net_config->ip : "-";
+	key += "|" + to_string(net_config->port) + "|" + to_string(net_config->timeout_ms);
+
+	for(int i=0;i<hw_size;++i)
+	{
+		strings[0] = hw_config[i].hardware;
+		strings[1] = hw_config[i].codec;
+		strings[2] = hw_config[i].device;
+		strings[3] = hw_config[i].pixel_format;
+
+		for(int s=0;s<4;++s)
+			key += strings[s] ? string("|+") + strings[s] : "|-";
+
+		key += "|" + to_string(hw_config[i].width) + "|" + to_string(hw_config[i].height) +
+			"|" + to_string(hw_config[i].profile);
+	}
+
+	return key;
+}
+
+//network frame lost entirely is found from timestamp gap (constant frame interval is assumed,
+//the smallest timestamp difference of session is the interval), subframe lost from missing
+//frame of decoder when the others got theirs. Decoder needs keyframe to recover after loss
+//or corruption, without back channel to sender the request and the wait are only counted.
+static void unhvd_track_loss(unhvd *u, AVFrame *frames[])
+{
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	bool lost[UNHVD_MAX_DECODERS] = {false};
+	int64_t pts = AV_NOPTS_VALUE;
+	int received = 0;
+
+	for(int i=0;i<u->decoders;++i)
+		if(frames[i])
+		{
+			if(!received++)
+				pts = frames[i]->pts;
+		}
+
+	if(!received)
+		return;
+
+	for(int i=0;i<u->decoders;++i)
+		if(!frames[i])
+		{
+			lost[i] = true;
+			++u->stats_local.lost_subframes;
+		}
+
+	if(pts != AV_NOPTS_VALUE && u->loss_pts != AV_NOPTS_VALUE && pts > u->loss_pts)
+	{
+		const int64_t step = pts - u->loss_pts;
+
+		if(u->loss_pts_step == 0 || step < u->loss_pts_step)
+			u->loss_pts_step = step;
+
+		const int64_t missing = step / u->loss_pts_step - 1;
+
+		if(missing > 0)
+		{
+			u->stats_local.lost_frames += missing;
+
+			for(int i=0;i<u->decoders;++i)
+				lost[i] = true;
+		}
+	}
+
+	u->loss_pts = pts;
+
+	for(int i=0;i<u->decoders;++i)
+	{
+		const bool corrupt = frames[i] && unhvd_frame_corrupt(frames[i]);
+
+		if( (lost[i] || corrupt) && !u->keyframe_wait[i])
+		{
+			u->keyframe_wait[i] = true;
+			u->keyframe_wait_start[i] = now;
+			++u->stats_local.keyframe_requests;
+		}
+
+		if(u->keyframe_wait[i] && frames[i] && !corrupt && unhvd_key_frame(frames[i]))
+		{
+			const int wait_us = std::chrono::duration_cast<std::chrono::microseconds>(now - u->keyframe_wait_start[i]).count();
+
+			u->keyframe_wait[i] = false;
+			u->stats_local.keyframe_wait_us = wait_us;
+			u->stats_local.keyframe_wait_max_us = max(u->stats_local.keyframe_wait_max_us, wait_us);
+		}
+	}
+}
+
+//on miss parked decoders bound to the same port are closed so that nhvd_init can bind
+static nhvd *unhvd_warm_take(const string &key, uint16_t port)
+{
+	std::lock_guard<std::mutex> warm_guard(unhvd_warm_mutex);
+
+	for(size_t i=0;i<unhvd_warm_pool.size();++i)
+		if(unhvd_warm_pool[i].key == key)
+		{
+			nhvd *n = unhvd_warm_pool[i].network_decoder;
+			unhvd_warm_pool.erase(unhvd_warm_pool.begin() + i);
+			return n;
+		}
+
+	for(size_t i=0;i<unhvd_warm_pool.size();)
+		if(unhvd_warm_pool[i].port == port)
+		{
+			nhvd_close(unhvd_warm_pool[i].network_decoder);
+			unhvd_warm_pool.erase(unhvd_warm_pool.begin() + i);
+		}
+		else
+			++i;
+
+	return NULL;
+}
+
+//discards frames queued by socket while decoder was parked,
+//queued data is decoded without waiting for network
+static void unhvd_warm_drain(unhvd *u)
+{
+	AVFrame *frames[UNHVD_MAX_DECODERS];
+
+	for(int f=0;f<UNHVD_WARM_DRAIN_MAX_FRAMES && u->keep_working;++f)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		//on timeout nothing is queued, on error the decoding loop finds out
+		if(unhvd_receive(u, frames) != NHVD_OK)
+			return;
+
+		const int elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		if(elapsed_us >= UNHVD_WARM_DRAIN_WAIT_US)
+			return; //waited for live data, lost single frame
+
+		++u->stats_local.warm_drained;
+	}
+}
+
+//AVFrame::key_frame is deprecated since FFmpeg 6.1
+static bool unhvd_key_frame(const AVFrame *frame)
+{
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+	return frame->flags & AV_FRAME_FLAG_KEY;
+#else
+	return frame->key_frame;
+#endif
+}
+
 static int UNHVD_ERROR_MSG(const char *msg)
 {
 	cerr << "unhvd: " << msg << endl;
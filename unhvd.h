@@ -112,10 +112,107 @@ struct unhvd_depth_config
 	float max_margin; //!< maximal margin to treat as valid in result unit (raw data * depth_unit);
 };
 
+/**
+ * @struct unhvd_depth_ext_config
+ * @brief Extended depth unprojection configuration.
+ *
+ * Optional addition to ::unhvd_depth_config, zero initialized (or NULL)
+ * means whole frame without culling, summary and levels of detail.
+ *
+ * Pixel region of interest limits unprojection to part of the depth map,
+ * pixels outside of it are not processed at all. The region is clipped to the frame.
+ *
+ * Box culls points outside of (possibly oriented) box in result coordinates.
+ * Point p is kept if for each axis k with non zero half size |(R^T (p - center))_k| <= half_size_k.
+ * Axes with 0 half size are unbounded, e.g. half size {0, 0, 2} keeps slab 2 units around center z.
+ *
+ * With region and box point cloud size and used count scale with region of interest.
+ *
+ * Optional summary (bounds, centroid, nearest point, depth histogram) of kept points
+ * is reduced while unprojecting, in the same pass over depth map, and retrieved
+ * with ::unhvd_get_point_cloud_summary.
+ *
+ * Optional levels of detail are unprojected from depth decimated 2x2 (level 1)
+ * and 4x4 (level 2, decimated from level 1) selecting one sample of each 2x2 block
+ * with lod_method. Culling and summary apply to every level.
+ *
+ * @see unhvd_pipeline_config, unhvd_set_depth_config
+ */
+struct unhvd_depth_ext_config
+{
+	int roi_x; //!< region of interest left column
+	int roi_y; //!< region of interest top row
+	int roi_width; //!< region of interest width or 0 for whole frame
+	int roi_height; //!< region of interest height or 0 for whole frame
+	float box_center[3]; //!< culling box center in result unit
+	float box_half_size[3]; //!< culling box half sizes in result unit, 0 for unbounded axis (all 0 disables culling)
+	float box_rotation[9]; //!< culling box orientation R (row major), all 0 for axis aligned box
+	int summary; //!< non zero to compute ::unhvd_point_cloud_summary
+	float histogram_min; //!< depth (z) histogram lower bound in result unit
+	float histogram_max; //!< depth (z) histogram upper bound in result unit
+	int lod_levels; //!< number of decimated levels of detail, 0 to UNHVD_MAX_LOD_LEVELS - 1
+	int lod_method; //!< UNHVD_LOD_MIN, UNHVD_LOD_MEDIAN or UNHVD_LOD_NEAREST_VALID
+};
+
 enum UNHVD_COMPILE_TIME_CONSTANTS
 {
 	UNHVD_MAX_DECODERS = 3, //!< max number of decoders in multi-frame decoding
-	UNHVD_NUM_DATA_POINTERS = 3 //!< max number of planes for planar image formats
+	UNHVD_NUM_DATA_POINTERS = 3, //!< max number of planes for planar image formats
+	UNHVD_MAX_DMABUF_OBJECTS = 4, //!< max number of dmabuf objects of exported frame
+	UNHVD_MAX_DMABUF_PLANES = 4, //!< max number of planes of exported frame
+	UNHVD_HISTOGRAM_BINS = 64, //!< number of bins of point cloud depth histogram
+	UNHVD_MAX_LOD_LEVELS = 3 //!< full resolution and up to 2 decimated point cloud levels
+};
+
+/**
+  * @brief Selection of depth sample in decimated level of detail
+  */
+enum unhvd_lod_method_enum
+{
+	UNHVD_LOD_MIN=0, //!< the nearest valid sample (conservative for obstacles)
+	UNHVD_LOD_MEDIAN=1, //!< lower median of valid samples (robust to flying pixels)
+	UNHVD_LOD_NEAREST_VALID=2, //!< the first valid sample in row major order (cheapest)
+};
+
+/**
+ * @struct unhvd_dmabuf
+ * @brief Exported hardware frame description.
+ *
+ * Frame is described by dmabuf objects (file descriptors) and planes
+ * referencing them with offsets and pitches. Layers of DRM PRIME frame
+ * are flattened, each plane has DRM fourcc format of its layer.
+ *
+ * File descriptors are owned by the library and valid only until the end of retrieval.
+ * Import them (e.g. EGL_EXT_image_dma_buf_import, VK_EXT_external_memory_dma_buf)
+ * or dup them if you need them later.
+ *
+ * @see unhvd_export_enum, unhvd_frame_info
+ */
+struct unhvd_dmabuf
+{
+	int objects; //!< number of objects, 0 if frame was not exported (use unhvd_frame::data)
+	int fd[UNHVD_MAX_DMABUF_OBJECTS]; //!< dmabuf file descriptors
+	uint64_t size[UNHVD_MAX_DMABUF_OBJECTS]; //!< total size of objects
+	uint64_t modifier[UNHVD_MAX_DMABUF_OBJECTS]; //!< DRM format modifiers of objects
+	int planes; //!< number of planes
+	uint32_t format[UNHVD_MAX_DMABUF_PLANES]; //!< DRM fourcc format of plane layer
+	int object[UNHVD_MAX_DMABUF_PLANES]; //!< index of object holding the plane
+	int offset[UNHVD_MAX_DMABUF_PLANES]; //!< offset of plane in object
+	int pitch[UNHVD_MAX_DMABUF_PLANES]; //!< pitch (stride) of plane
+};
+
+/**
+  * @brief Export of decoded frames (Linux)
+  *
+  * Exported frames are described by unhvd_frame_info::dmabuf instead of unhvd_frame::data.
+  * If export is not possible the frame falls back to system memory data.
+  * Decoders used for depth unprojection may not export.
+  */
+enum unhvd_export_enum
+{
+	UNHVD_EXPORT_NONE=0, //!< system memory data
+	UNHVD_EXPORT_DMABUF=1, //!< map hardware frames to DRM PRIME (dmabuf) descriptors
+	UNHVD_EXPORT_MEMFD=2, //!< as UNHVD_EXPORT_DMABUF, system memory frames are copied to memfd backed buffers
 };
 
 /**
@@ -138,6 +235,22 @@ struct unhvd_frame
 	int linesize[UNHVD_NUM_DATA_POINTERS]; //!< array of strides of frame planes (row length including padding)
 };
 
+/**
+ * @struct unhvd_frame_info
+ * @brief Additional information about retrieved frame.
+ *
+ * Kept separate from ::unhvd_frame so that its layout stays unchanged.
+ *
+ * @see unhvd_get_frame_info, unhvd_callback
+ */
+struct unhvd_frame_info
+{
+	int64_t pts; //!< timestamp of the frame used for matching sets
+	int fresh; //!< non zero if frame was decoded since last retrieval, 0 if stale (no data)
+	int corrupt; //!< non zero if decoder flagged the frame as corrupt or reported decode errors
+	unhvd_dmabuf dmabuf; //!< exported frame description, unhvd_frame::data is NULL for exported frames
+};
+
 /**
   * @brief Vertex data (x, y, z)
   */
@@ -148,6 +261,27 @@ typedef float float3[3];
   */
 typedef uint32_t color32;
 
+/**
+ * @struct unhvd_point_cloud_summary
+ * @brief Reductions over used points of point cloud.
+ *
+ * Histogram splits [histogram_min, histogram_max) of depth (z) into equal bins,
+ * points outside of the range are counted in the first or last bin.
+ * All fields are 0 if there are no used points.
+ *
+ * @see unhvd_depth_ext_config, unhvd_get_point_cloud_summary
+ */
+struct unhvd_point_cloud_summary
+{
+	float min[3]; //!< bounding box minimum corner
+	float max[3]; //!< bounding box maximum corner
+	float centroid[3]; //!< mean of points
+	float nearest; //!< distance from origin (sensor) to the nearest point
+	float histogram_min; //!< lower bound of the first bin
+	float histogram_max; //!< upper bound of the last bin
+	uint32_t histogram[UNHVD_HISTOGRAM_BINS]; //!< number of points in each depth bin
+};
+
 /**
  * @struct unhvd_point_cloud
  * @brief Point cloud abstraction.
@@ -164,6 +298,215 @@ struct unhvd_point_cloud
 	int used; //!< number of elements used in array
 };
 
+/**
+ * @brief Callback called from decoding thread with each set of frames.
+ *
+ * The frame and info arrays have one entry for each hardware decoder (stale entries have no data).
+ * Point cloud is NULL if the set was not unprojected.
+ *
+ * The data is borrowed only for the duration of the callback, copy it if you need it later.
+ * Decoding is stalled while callback executes so be as fast as possible.
+ * Callbacks running longer than unhvd_pipeline_config::callback_budget_us
+ * are counted in unhvd_stats::callback_overruns.
+ *
+ * Do not call library functions from the callback.
+ *
+ * @see unhvd_pipeline_config, unhvd_get_stats
+ */
+typedef void (*unhvd_callback)(const unhvd_frame *frame, const unhvd_frame_info *info, int frames, const unhvd_point_cloud *pc, void *user);
+
+/**
+ * @struct unhvd_publish_config
+ * @brief Point cloud re-streaming configuration.
+ *
+ * Unprojected point clouds are served to TCP subscribers
+ * in compact format described in unhvd_cloud_codec.h.
+ *
+ * @see unhvd_pipeline_config
+ */
+struct unhvd_publish_config
+{
+	const char *ip; //!< IP to listen on for subscribers or NULL (listen on any)
+	uint16_t port; //!< port to listen on for subscribers
+	float quantization; //!< position quantization step in result unit or 0 for default (0.001)
+};
+
+/**
+  * @brief Scheduling policies of pipeline threads
+  */
+enum unhvd_sched_policy_enum
+{
+	UNHVD_SCHED_DEFAULT=0, //!< default (SCHED_OTHER) policy, priority is nice value
+	UNHVD_SCHED_FIFO=1, //!< real-time SCHED_FIFO policy, priority is 1-99 (needs privileges)
+};
+
+/**
+ * @struct unhvd_thread_config
+ * @brief Pipeline thread scheduling configuration (Linux).
+ *
+ * Zeroed configuration leaves thread with defaults.
+ * Settings that can't be applied (e.g. no privileges) are reported on stderr
+ * and the thread continues with what was possible, see ::unhvd_stats.
+ *
+ * @see unhvd_pipeline_config
+ */
+struct unhvd_thread_config
+{
+	const char *name; //!< NULL or thread name (up to 15 characters)
+	uint64_t cpu_mask; //!< 0 or affinity mask, bit n for CPU n
+	int policy; //!< UNHVD_SCHED_DEFAULT or UNHVD_SCHED_FIFO
+	int priority; //!< nice value for UNHVD_SCHED_DEFAULT, priority for UNHVD_SCHED_FIFO
+};
+
+/**
+ * @struct unhvd_record_config
+ * @brief Recording configuration.
+ *
+ * Published sets (frames and point cloud) are recorded to file by background thread.
+ * Recording is read with unhvd_record.h reader, see the file for details.
+ *
+ * Sets are queued in queue_size preallocated buffers. Frames are referenced
+ * (decoded frames stay allocated until written), only point cloud is copied.
+ * If writing can't keep up sets are dropped, recording never blocks decoding.
+ *
+ * Frames exported as dmabuf (or kept in hardware) are recorded without data.
+ *
+ * @see unhvd_pipeline_config
+ */
+struct unhvd_record_config
+{
+	const char *path; //!< recording file (overwritten)
+	int queue_size; //!< number of sets buffered for writing or 0 for default
+};
+
+/**
+  * @brief Handling of sets with frames flagged corrupt by decoder (e.g. after packet loss)
+  */
+enum unhvd_corrupt_policy_enum
+{
+	UNHVD_CORRUPT_PUBLISH=0, //!< publish and unproject as usual (decoder conceals errors)
+	UNHVD_CORRUPT_REUSE=1, //!< publish frames but skip unprojection, last good point cloud is kept
+	UNHVD_CORRUPT_DROP=2, //!< drop the whole set
+};
+
+/**
+ * @struct unhvd_pipeline_config
+ * @brief Decoding pipeline configuration.
+ *
+ * With sync enabled frames of multi-frame stream (e.g. depth + texture)
+ * are assembled into sets and published only when all of them are present
+ * and their timestamps differ at most by max_skew. Timestamp is frame pts
+ * or sequence number of received network (MLSP) frame if pts is not available.
+ * Unmatched frames replaced by newer ones are counted in unhvd_stats::dropped.
+ *
+ * Without sync frames are published as they are decoded.
+ *
+ * Optional callback is called from the decoding thread with each set
+ * just before it is published. See ::unhvd_callback for details.
+ *
+ * Optional depth extension configures region of interest and culling box
+ * of unprojection (requires depth config), see ::unhvd_depth_ext_config.
+ *
+ * Optional publish configuration enables re-streaming of point clouds.
+ * Optional record configuration enables recording of sets to file.
+ * They are used only during ::unhvd_init_pipeline.
+ *
+ * Frames flagged corrupt by decoder are handled according to corrupt_policy
+ * and marked in unhvd_frame_info::corrupt.
+ * Lost network frames and subframes are counted in ::unhvd_stats together with
+ * keyframes decoders need to recover from loss or corruption.
+ *
+ * Frames of decoders with export_dmabuf are exported as dmabuf, see ::unhvd_export_enum.
+ * With UNHVD_EXPORT_MEMFD software decoded frames are copied once to memfd buffers,
+ * converted to dmabuf with /dev/udmabuf if available (memfd descriptor is returned otherwise).
+ *
+ * Streaming session starts with data after startup or timeout (e.g. sender restart).
+ * With resync frames of decoder are discarded from session start until it outputs
+ * keyframe, frames decoded without references are not published.
+ *
+ * With keep_warm ::unhvd_close parks network decoder (socket and hardware decoders)
+ * in process wide pool instead of closing it. The next init with identical network
+ * and hardware configuration reuses it without initialization, see ::unhvd_warm_pool_clear.
+ * Frames queued by its socket while parked are discarded. Init with different configuration
+ * closes parked decoders bound to the same port.
+ *
+ * Decoding thread receives, decodes and unprojects data (these stages run
+ * sequentially in single thread). Publisher thread sends point clouds.
+ * Recorder thread writes recording.
+ *
+ * @see unhvd_init_pipeline, unhvd_callback, unhvd_publish_config, unhvd_record_config, unhvd_thread_config
+ */
+struct unhvd_pipeline_config
+{
+	int sync; //!< 0 to publish frames as they come, non zero to publish only matched sets
+	int max_skew; //!< maximum timestamp difference between frames of the set (0 for exact match)
+	unhvd_callback callback; //!< NULL or function called with each set
+	void *callback_user; //!< user data passed to callback
+	int callback_budget_us; //!< 0 or callback execution time above which overrun is counted
+	const unhvd_publish_config *publish; //!< NULL or point cloud re-streaming configuration
+	unhvd_thread_config decoder_thread; //!< decoding thread scheduling
+	unhvd_thread_config publisher_thread; //!< publisher thread scheduling
+	int corrupt_policy; //!< UNHVD_CORRUPT_PUBLISH, UNHVD_CORRUPT_REUSE or UNHVD_CORRUPT_DROP
+	const unhvd_record_config *record; //!< NULL or recording configuration
+	unhvd_thread_config recorder_thread; //!< recorder thread scheduling
+	int export_dmabuf[UNHVD_MAX_DECODERS]; //!< per decoder UNHVD_EXPORT_NONE, UNHVD_EXPORT_DMABUF or UNHVD_EXPORT_MEMFD
+	const unhvd_depth_ext_config *depth_ext; //!< NULL or extended depth configuration
+	int resync; //!< non zero to discard frames of new session until decoder keyframe
+	int keep_warm; //!< non zero to park network decoder in warm pool on ::unhvd_close
+};
+
+/**
+ * @struct unhvd_stats
+ * @brief Decoding pipeline statistics.
+ *
+ * @see unhvd_get_stats
+ */
+struct unhvd_stats
+{
+	uint64_t sets; //!< number of published sets
+	uint64_t dropped; //!< number of frames dropped or replaced by set assembly (sync)
+	uint64_t callbacks; //!< number of callback calls
+	uint64_t callback_overruns; //!< number of callbacks running longer than budget
+	int callback_max_us; //!< longest callback execution time
+	uint64_t exported; //!< number of frames exported as dmabuf
+	uint64_t export_fallbacks; //!< number of frames that could not be exported
+	uint64_t point_cloud_allocations; //!< number of point cloud buffer (re)allocations, constant in steady state
+	int publish_subscribers; //!< number of connected point cloud subscribers
+	uint64_t published; //!< number of encoded point clouds
+	uint64_t publish_dropped; //!< number of encoded point clouds replaced by newer before sending
+	uint64_t publish_bytes; //!< total size of encoded point clouds
+	uint64_t publish_raw_bytes; //!< total size of the same point clouds as float3 and color32
+	uint64_t publish_encode_us; //!< total point cloud encoding time
+	int publish_encode_max_us; //!< longest point cloud encoding time
+	uint64_t sessions; //!< number of streaming sessions (data after startup or timeout, e.g. sender restart)
+	int time_to_first_set_us; //!< time from first data of the last session to its first published set
+	int time_to_first_set_max_us; //!< longest time to first published set of all sessions
+	uint64_t resync_dropped; //!< number of frames discarded waiting for keyframe (resync)
+	int warm_start; //!< non zero if network decoder was reused from warm pool
+	uint64_t warm_drained; //!< number of stale frames (queued while parked) discarded after warm start
+	int decoder_thread_cpu; //!< CPU the decoding thread last published from or -1 if unknown
+	int decoder_thread_policy; //!< decoding thread effective UNHVD_SCHED_DEFAULT or UNHVD_SCHED_FIFO
+	int decoder_thread_priority; //!< decoding thread effective nice value or SCHED_FIFO priority
+	int publisher_thread_cpu; //!< CPU the publisher thread last sent from or -1 if unknown (or no publisher)
+	int publisher_thread_policy; //!< publisher thread effective UNHVD_SCHED_DEFAULT or UNHVD_SCHED_FIFO
+	int publisher_thread_priority; //!< publisher thread effective nice value or SCHED_FIFO priority
+	int recorder_thread_cpu; //!< CPU the recorder thread last wrote from or -1 if unknown (or no recorder)
+	int recorder_thread_policy; //!< recorder thread effective UNHVD_SCHED_DEFAULT or UNHVD_SCHED_FIFO
+	int recorder_thread_priority; //!< recorder thread effective nice value or SCHED_FIFO priority
+	uint64_t corrupt_frames; //!< number of frames flagged corrupt by decoder
+	uint64_t corrupt_sets_reused; //!< number of sets not unprojected due to corruption (UNHVD_CORRUPT_REUSE)
+	uint64_t corrupt_sets_dropped; //!< number of sets dropped due to corruption (UNHVD_CORRUPT_DROP)
+	uint64_t recorded; //!< number of sets written to recording
+	uint64_t record_dropped; //!< number of sets not recorded because writing could not keep up
+	uint64_t record_bytes; //!< number of bytes written to recording
+	uint64_t unproject_rejected; //!< number of sets not unprojected due to invalid frame format, size or stride
+	uint64_t lost_frames; //!< number of network frames lost, estimated from timestamp gaps (constant frame interval)
+	uint64_t lost_subframes; //!< number of frames of decoder missing from received network frames
+	uint64_t keyframe_requests; //!< number of times decoder needed keyframe after loss or corruption (counted, not sent)
+	int keyframe_wait_us; //!< time from the last loss or corruption to keyframe that recovered decoder
+	int keyframe_wait_max_us; //!< longest keyframe_wait_us
+};
+
 /**
   * @brief Constants returned by most of library functions
   */
@@ -189,13 +532,38 @@ enum unhvd_retval_enum
  * - pointer to internal library data
  * - NULL on error, errors printed to stderr
  *
- * @see unhvd_net_config, unhvd_hw_config, unhvd_depth_config
+ * @see unhvd_net_config, unhvd_hw_config, unhvd_depth_config, unhvd_init_pipeline
  */
 UNHVD_EXPORT UNHVD_API struct unhvd *unhvd_init(
 	const unhvd_net_config *net_config,
 	const unhvd_hw_config *hw_config, int hw_size,
 	const unhvd_depth_config *depth_config);
 
+/**
+ * @brief Initialize internal library data with decoding pipeline configuration.
+ *
+ * The same as ::unhvd_init with additional pipeline configuration
+ * (set assembly, callback, re-streaming, recording, threads).
+ *
+ * NULL pipeline_config is the same as zeroed configuration and ::unhvd_init.
+ *
+ * @param net_config network configuration
+ * @param hw_config hardware decoders configuration of hw_size size
+ * @param hw_size number of supplied hardware decoder configurations
+ * @param depth_config unprojection configuration (may be NULL)
+ * @param pipeline_config pipeline configuration (may be NULL)
+ * @return
+ * - pointer to internal library data
+ * - NULL on error, errors printed to stderr
+ *
+ * @see unhvd_init, unhvd_pipeline_config
+ */
+UNHVD_EXPORT UNHVD_API struct unhvd *unhvd_init_pipeline(
+	const unhvd_net_config *net_config,
+	const unhvd_hw_config *hw_config, int hw_size,
+	const unhvd_depth_config *depth_config,
+	const unhvd_pipeline_config *pipeline_config);
+
 /**
  * @brief Free library resources
  *
@@ -213,6 +581,11 @@ UNHVD_EXPORT UNHVD_API void unhvd_close(unhvd *u);
  *  unhvd_xxx_begin functions should be always followed by corresponding unhvd_xxx_end calls.
  *  A mutex is held between begin and end function so be as fast as possible.
  *
+ *  The mutex is held after begin function returns regardless of return value
+ *  (also UNHVD_ERROR when there is no new data) and is released by the end function.
+ *  Call the end function exactly once after each begin function, from the same thread.
+ *  The only exception is NULL library pointer for which nothing is locked.
+ *
  *  The ownership of the data remains with the library. You should consume the data immidiately
  *  (e.g. fill the texture, fill the vertex buffer). The data is valid only until call to corresponding end
  *  function.
@@ -222,6 +595,10 @@ UNHVD_EXPORT UNHVD_API void unhvd_close(unhvd *u);
  *
  *  Functions will calculate point clouds from depth maps only if non NULL ::unhvd_depth_config was passed to ::unhvd_init
  *
+ *  Stale frames of the set (not decoded since last retrieval) have no data, see ::unhvd_get_frame_info.
+ *  With ::unhvd_pipeline_config sync all frames of the set are fresh
+ *  and point cloud is unprojected only from matched depth and texture.
+ *
  * @param n pointer to internal library data
  * @param frame pointer to frame description data (single or array)
  * @param pc pointer to point cloud description data
@@ -253,8 +630,95 @@ UNHVD_EXPORT UNHVD_API int unhvd_get_frame_end(unhvd *u);
 UNHVD_EXPORT UNHVD_API int unhvd_get_point_cloud_begin(unhvd *u, unhvd_point_cloud *pc);
 /** @brief Finish retrieval. */
 UNHVD_EXPORT UNHVD_API int unhvd_get_point_cloud_end(unhvd *u);
+/** @brief Retrieve point cloud level of detail (0 is full resolution).
+ *
+ * Levels not configured in ::unhvd_depth_ext_config have no used points.
+ * Returns UNHVD_ERROR for level out of range.
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_get_point_cloud_level_begin(unhvd *u, int level, unhvd_point_cloud *pc);
+/** @brief Wait up to timeout_ms for new data and retrieve it like ::unhvd_get_begin.
+ *
+ * Returns UNHVD_ERROR if there is still no new data after timeout.
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_wait_begin(unhvd *u, unhvd_frame *frame, unhvd_point_cloud *pc, int timeout_ms);
+/** @brief Get information (timestamp, freshness, corruption, dmabuf) about retrieved frames.
+ *
+ * May be called only between successful begin and end functions.
+ * The argument info should point to single unhvd_frame_info or array like frame argument.
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_get_frame_info(unhvd *u, unhvd_frame_info *info);
+/** @brief Get summary of retrieved point cloud level of detail (0 is full resolution).
+ *
+ * May be called only between successful begin and end functions.
+ * Returns UNHVD_ERROR if summary was not requested in ::unhvd_depth_ext_config,
+ * the level was not unprojected or is out of range.
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_get_point_cloud_summary(unhvd *u, int level, unhvd_point_cloud_summary *summary);
 ///@}
 
+/**
+ * @brief Close network decoders parked in warm pool.
+ *
+ * Call when no more initializations are expected (e.g. before exit)
+ * to free sockets and hardware decoders kept by unhvd_pipeline_config::keep_warm.
+ */
+UNHVD_EXPORT UNHVD_API void unhvd_warm_pool_clear();
+
+/**
+ * @brief Change depth unprojection configuration at runtime.
+ *
+ * New configuration (e.g. intrinsics, margins, region of interest, culling box)
+ * is validated and prepared immediately and applied atomically by the decoding
+ * thread before the next frame. Decoding is not interrupted.
+ *
+ * Calling again before configuration is applied replaces it.
+ *
+ * Changes of stream resolution need no reconfiguration, decoders follow
+ * the stream and point cloud buffers are reused if large enough.
+ *
+ * @param u pointer to internal library data
+ * @param depth_config new unprojection configuration
+ * @param depth_ext NULL or new extended configuration (NULL for whole frame without culling)
+ * @return
+ * - UNHVD_OK on success
+ * - UNHVD_ERROR on error (e.g. invalid configuration or unprojection not enabled in ::unhvd_init)
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_set_depth_config(unhvd *u, const unhvd_depth_config *depth_config,
+	const unhvd_depth_ext_config *depth_ext);
+
+/**
+ * @brief Get decoding pipeline statistics.
+ *
+ * Statistics are updated by the decoding thread when sets are published
+ * and when frames are dropped without publishing (sync, corruption, timeout).
+ *
+ * @param u pointer to internal library data
+ * @param stats pointer to statistics to fill
+ * @return
+ * - UNHVD_OK on success
+ * - UNHVD_ERROR on error
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_get_stats(unhvd *u, unhvd_stats *stats);
+
+/**
+ * @brief Get file descriptor signalled on new data.
+ *
+ * The descriptor (Linux eventfd) becomes readable when new set of frames is published
+ * and may be used with select/poll/epoll. It is cleared by data retrieval functions.
+ *
+ * When decoding thread finishes (e.g. fatal decoder error) the descriptor becomes
+ * and stays readable. Retrieval functions return the last set (if not retrieved yet)
+ * and then UNHVD_ERROR.
+ *
+ * Do not close or read the descriptor, it is owned by the library.
+ *
+ * @param u pointer to internal library data
+ * @return
+ * - file descriptor
+ * - -1 if not available (non Linux platforms)
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_get_fd(unhvd *u);
+
 /** @}*/
 }
 
@@ -0,0 +1,549 @@
+/*
+ * UNHVD point cloud codec library implementation
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "unhvd_cloud_codec.h"
+
+#include <iostream>
+#include <vector>
+#include <string.h> //memcpy
+
+using namespace std;
+
+//"UPCC" little endian
+static const uint32_t UNHVD_CLOUD_MAGIC = 0x43435055;
+static const uint8_t UNHVD_CLOUD_VERSION = 3; //intra only, entropy coded
+
+//positions are 3 varints, color 1 varint, up to 5 bytes each
+static const int UNHVD_CLOUD_MAX_POINT_SIZE = 4 * 5;
+
+//order 0 byte-wise rANS with 32 bit state, frequencies sum to RANS_M
+static const int RANS_SCALE_BITS = 12;
+static const uint32_t RANS_M = 1u << RANS_SCALE_BITS;
+static const uint32_t RANS_L = 1u << 23; //lower bound of normalized state
+static const int RANS_SYMBOLS = 256;
+
+//encoder symbol with division replaced by multiplication with reciprocal
+struct rans_symbol
+{
+	uint32_t x_max; //state renormalization bound
+	uint32_t rcp_freq;
+	uint32_t bias;
+	uint32_t cmpl_freq; //RANS_M - freq
+	uint32_t rcp_shift;
+};
+
+struct unhvd_cloud_codec
+{
+	float quantization;
+
+	//scratch buffers, only grow (no allocation in steady state)
+	vector<uint8_t> coded; //encoder, entropy coded payload written from the end
+	vector<uint8_t> raw; //decoder, payload before entropy coding
+
+	uint8_t slot_symbol[RANS_M]; //decoder, symbol of each cumulative frequency slot
+
+	unhvd_cloud_codec(float q):
+		quantization(q)
+	{}
+};
+
+static int UNHVD_CLOUD_ERROR_MSG(const char *msg);
+
+struct unhvd_cloud_codec *unhvd_cloud_codec_init(float quantization)
+{
+	if(!(quantization > 0.0f))
+		quantization = 0.001f; //decoder or default, millimeters for meters
+
+	unhvd_cloud_codec *c = new unhvd_cloud_codec(quantization);
+
+	if(c == NULL)
+	{
+		UNHVD_CLOUD_ERROR_MSG("not enough memory for point cloud codec");
+		return NULL;
+	}
+
+	return c;
+}
+
+void unhvd_cloud_codec_close(unhvd_cloud_codec *c)
+{
+	delete c;
+}
+
+int unhvd_cloud_encode_bound(int points)
+{
+	return UNHVD_CLOUD_HEADER_SIZE + points * UNHVD_CLOUD_MAX_POINT_SIZE;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint8_t *write_varint(uint8_t *out, uint32_t v)
+{
+	while(v >= 0x80)
+	{
+		*out++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (uint8_t)v;
+	return out;
+}
+
+//NULL on reading past end or overlong encoding
+static inline const uint8_t *read_varint(const uint8_t *in, const uint8_t *end, uint32_t *v)
+{
+	uint32_t result = 0;
+
+	for(int shift = 0; shift < 35 && in < end; shift += 7)
+	{
+		const uint8_t byte = *in++;
+		result |= (uint32_t)(byte & 0x7F) << shift;
+
+		if(!(byte & 0x80))
+		{
+			*v = result;
+			return in;
+		}
+	}
+
+	return NULL;
+}
+
+//spread 8 bits to every 4th bit of 32 bit value
+static inline uint32_t spread_bits(uint32_t x)
+{
+	x &= 0xFF;
+	x = (x | (x << 12)) & 0x000F000F;
+	x = (x | (x << 6)) & 0x03030303;
+	x = (x | (x << 3)) & 0x11111111;
+	return x;
+}
+
+static inline uint32_t compact_bits(uint32_t x)
+{
+	x &= 0x11111111;
+	x = (x | (x >> 3)) & 0x03030303;
+	x = (x | (x >> 6)) & 0x000F000F;
+	x = (x | (x >> 12)) & 0xFF;
+	return x;
+}
+
+//per channel difference (modulo 256) of two colors, zigzag mapped and bit interleaved
+//so that small differences in all channels give small value (e.g. no change is single 0 byte)
+static inline uint8_t *write_color(uint8_t *out, uint32_t color, uint32_t reference)
+{
+	uint32_t v = 0;
+
+	for(int c=0;c<4;++c)
+	{
+		const int8_t delta = (int8_t)(uint8_t)((color >> (8*c)) - (reference >> (8*c)));
+		v |= spread_bits(zigzag(delta)) << c;
+	}
+
+	return write_varint(out, v);
+}
+
+static inline const uint8_t *read_color(const uint8_t *in, const uint8_t *end, uint32_t reference, uint32_t *color)
+{
+	uint32_t v, result = 0;
+
+	if( (in = read_varint(in, end, &v)) == NULL)
+		return NULL;
+
+	for(int c=0;c<4;++c)
+	{
+		const uint8_t channel = (uint8_t)((reference >> (8*c)) + unzigzag(compact_bits(v >> c)));
+		result |= (uint32_t)channel << (8*c);
+	}
+
+	*color = result;
+	return in;
+}
+
+//scale byte counts to frequencies summing to RANS_M, present bytes keep at least 1
+static void normalize_frequencies(const uint32_t count[RANS_SYMBOLS], uint32_t total, uint32_t freq[RANS_SYMBOLS])
+{
+	uint32_t sum = 0;
+	int largest = 0;
+
+	for(int s=0;s<RANS_SYMBOLS;++s)
+	{
+		freq[s] = count[s] ? (uint32_t)((uint64_t)count[s] * RANS_M / total) : 0;
+
+		if(count[s] && freq[s] == 0)
+			freq[s] = 1;
+
+		sum += freq[s];
+
+		if(count[s] > count[largest])
+			largest = s;
+	}
+
+	if(sum < RANS_M)
+		freq[largest] += RANS_M - sum;
+
+	//rounded up rare bytes are paid by the currently most frequent one
+	while(sum > RANS_M)
+	{
+		int max_s = 0;
+
+		for(int s=1;s<RANS_SYMBOLS;++s)
+			if(freq[s] > freq[max_s])
+				max_s = s;
+
+		--freq[max_s];
+		--sum;
+	}
+}
+
+static void rans_symbol_init(rans_symbol *s, uint32_t start, uint32_t freq)
+{
+	s->x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * freq;
+	s->cmpl_freq = RANS_M - freq;
+
+	if(freq < 2)
+	{	//reciprocal of 1 doesn't fit, x / 1 is computed as x * (2^32 - 1) >> 32 = x - 1
+		s->rcp_freq = ~0u;
+		s->rcp_shift = 0;
+		s->bias = start + RANS_M - 1;
+		return;
+	}
+
+	uint32_t shift = 0;
+
+	while(freq > (1u << shift))
+		++shift;
+
+	s->rcp_freq = (uint32_t)(((1ull << (shift + 31)) + freq - 1) / freq);
+	s->rcp_shift = shift - 1;
+	s->bias = start;
+}
+
+//encodes bytes backwards from the end of output, returns the first byte or NULL if output is too small
+static uint8_t *rans_encode(const uint8_t *in, int size, const rans_symbol sym[RANS_SYMBOLS], uint8_t *out, uint8_t *out_end)
+{
+	uint32_t x = RANS_L;
+	uint8_t *ptr = out_end;
+
+	for(int i=size-1;i>=0;--i)
+	{
+		const rans_symbol *s = &sym[in[i]];
+
+		while(x >= s->x_max)
+		{
+			if(ptr == out)
+				return NULL;
+
+			*--ptr = (uint8_t)x;
+			x >>= 8;
+		}
+
+		//x = (x / freq) * RANS_M + x % freq + start
+		const uint32_t q = (uint32_t)(((uint64_t)x * s->rcp_freq) >> 32) >> s->rcp_shift;
+		x += s->bias + q * s->cmpl_freq;
+	}
+
+	if(ptr - out < 4)
+		return NULL;
+
+	ptr -= 4;
+	memcpy(ptr, &x, 4); //little endian
+
+	return ptr;
+}
+
+//payload entropy coded in place if that makes it smaller:
+//raw size (varint), frequencies (256 varints), rANS stream
+static int entropy_encode(unhvd_cloud_codec *c, uint8_t *payload, int size)
+{
+	uint32_t count[RANS_SYMBOLS] = {0}, freq[RANS_SYMBOLS];
+	rans_symbol sym[RANS_SYMBOLS];
+
+	if(size == 0)
+		return 0;
+
+	for(int i=0;i<size;++i)
+		++count[payload[i]];
+
+	normalize_frequencies(count, size, freq);
+
+	uint8_t table[5 + RANS_SYMBOLS * 2];
+	uint8_t *t = write_varint(table, size);
+
+	for(uint32_t s=0, start=0;s<RANS_SYMBOLS;start += freq[s], ++s)
+	{
+		rans_symbol_init(&sym[s], start, freq[s]);
+		t = write_varint(t, freq[s]);
+	}
+
+	const int table_size = (int)(t - table);
+
+	if(table_size >= size)
+		return UNHVD_ERROR;
+
+	//the stream is worth it only if smaller than raw payload
+	uint8_t *coded_end = c->coded.data() + size - table_size;
+	uint8_t *coded = rans_encode(payload, size, sym, c->coded.data(), coded_end);
+
+	if(coded == NULL)
+		return UNHVD_ERROR;
+
+	const int coded_size = (int)(coded_end - coded);
+
+	memcpy(payload, table, table_size);
+	memcpy(payload + table_size, coded, coded_size);
+
+	return table_size + coded_size;
+}
+
+//decodes entropy coded payload to raw payload in codec scratch buffer
+static int entropy_decode(unhvd_cloud_codec *c, const uint8_t *in, const uint8_t *end, int max_size, int *raw_size)
+{
+	uint32_t size, freq[RANS_SYMBOLS], start[RANS_SYMBOLS];
+
+	if( (in = read_varint(in, end, &size)) == NULL || size > (uint32_t)max_size)
+		return UNHVD_ERROR;
+
+	uint32_t sum = 0;
+
+	for(int s=0;s<RANS_SYMBOLS;++s)
+	{
+		if( (in = read_varint(in, end, &freq[s])) == NULL || freq[s] > RANS_M - sum)
+			return UNHVD_ERROR;
+
+		start[s] = sum;
+		memset(c->slot_symbol + sum, s, freq[s]);
+		sum += freq[s];
+	}
+
+	if(sum != RANS_M || end - in < 4)
+		return UNHVD_ERROR;
+
+	if(c->raw.size() < size)
+		c->raw.resize(size);
+
+	uint8_t *out = c->raw.data();
+	uint32_t x;
+
+	memcpy(&x, in, 4); //little endian
+	in += 4;
+
+	for(uint32_t i=0;i<size;++i)
+	{
+		const uint32_t slot = x & (RANS_M - 1);
+		const uint8_t s = c->slot_symbol[slot];
+
+		out[i] = s;
+		x = freq[s] * (x >> RANS_SCALE_BITS) + slot - start[s];
+
+		while(x < RANS_L)
+		{
+			if(in == end)
+				return UNHVD_ERROR;
+
+			x = (x << 8) | *in++;
+		}
+	}
+
+	*raw_size = size;
+
+	return UNHVD_OK;
+}
+
+static inline int32_t quantize(float v, float inverse_step)
+{
+	const float q = v * inverse_step;
+	//clamp to representable range, far away points are not expected
+	if(q >= 2147483520.0f)
+		return INT32_MAX;
+	if(q <= -2147483520.0f)
+		return INT32_MIN;
+	//round half away from zero, faster than lrintf call
+	return (int32_t)(q < 0.0f ? q - 0.5f : q + 0.5f);
+}
+
+static void write_header(uint8_t *out, const unhvd_cloud_header &h)
+{
+	const uint8_t flags = (uint8_t)h.flags;
+	const uint16_t reserved = 0;
+	const uint32_t points = h.points;
+	const uint32_t payload_size = h.payload_size;
+
+	//the format is little endian, as are the supported platforms
+	memcpy(out, &UNHVD_CLOUD_MAGIC, 4);
+	memcpy(out + 4, &UNHVD_CLOUD_VERSION, 1);
+	memcpy(out + 5, &flags, 1);
+	memcpy(out + 6, &reserved, 2);
+	memcpy(out + 8, &points, 4);
+	memcpy(out + 12, &h.quantization, 4);
+	memcpy(out + 16, &h.pts, 8);
+	memcpy(out + 24, &payload_size, 4);
+}
+
+int unhvd_cloud_parse_header(const uint8_t *data, unhvd_cloud_header *header)
+{
+	uint32_t magic, points, payload_size;
+	uint8_t version, flags;
+
+	memcpy(&magic, data, 4);
+	memcpy(&version, data + 4, 1);
+	memcpy(&flags, data + 5, 1);
+	memcpy(&points, data + 8, 4);
+	memcpy(&header->quantization, data + 12, 4);
+	memcpy(&header->pts, data + 16, 8);
+	memcpy(&payload_size, data + 24, 4);
+
+	if(magic != UNHVD_CLOUD_MAGIC || version != UNHVD_CLOUD_VERSION)
+		return UNHVD_CLOUD_ERROR_MSG("not a point cloud message or unsupported version");
+
+	if(points > INT32_MAX / UNHVD_CLOUD_MAX_POINT_SIZE || payload_size > (uint32_t)points * UNHVD_CLOUD_MAX_POINT_SIZE)
+		return UNHVD_CLOUD_ERROR_MSG("corrupted point cloud message header");
+
+	header->flags = flags;
+	header->points = points;
+	header->payload_size = payload_size;
+
+	return UNHVD_OK;
+}
+
+int unhvd_cloud_encode(unhvd_cloud_codec *c, const unhvd_point_cloud *pc, int64_t pts,
+	uint8_t *out, int out_size)
+{
+	const int points = pc->used;
+
+	if(out_size < unhvd_cloud_encode_bound(points))
+		return UNHVD_CLOUD_ERROR_MSG("output buffer too small for point cloud");
+
+	const bool colors = pc->colors != NULL;
+
+	const float inverse_step = 1.0f / c->quantization;
+	uint8_t *o = out + UNHVD_CLOUD_HEADER_SIZE;
+
+	//predict from previous point, unprojected points come in row order so neighbours are close
+	int32_t prev[3] = {0, 0, 0};
+	uint32_t prev_color = 0;
+
+	for(int i=0;i<points;++i)
+	{
+		for(int j=0;j<3;++j)
+		{
+			const int32_t q = quantize(pc->data[i][j], inverse_step);
+			//wrap around on overflow, the same happens in decoder
+			o = write_varint(o, zigzag((int32_t)((uint32_t)q - (uint32_t)prev[j])));
+			prev[j] = q;
+		}
+
+		if(colors)
+		{
+			const uint32_t color = pc->colors[i];
+			o = write_color(o, color, prev_color);
+			prev_color = color;
+		}
+	}
+
+	int payload_size = (int)(o - out - UNHVD_CLOUD_HEADER_SIZE);
+
+	//scratch for the worst accepted case, grows once per output buffer size
+	if((int)c->coded.size() < out_size)
+		c->coded.resize(out_size);
+
+	const int entropy_size = entropy_encode(c, out + UNHVD_CLOUD_HEADER_SIZE, payload_size);
+
+	unhvd_cloud_header h;
+	h.flags = (colors ? UNHVD_CLOUD_FLAG_COLORS : 0) | (entropy_size > 0 ? UNHVD_CLOUD_FLAG_ENTROPY : 0);
+	h.points = points;
+	h.quantization = c->quantization;
+	h.pts = pts;
+	h.payload_size = entropy_size > 0 ? entropy_size : payload_size;
+
+	write_header(out, h);
+
+	return UNHVD_CLOUD_HEADER_SIZE + h.payload_size;
+}
+
+int unhvd_cloud_decode(unhvd_cloud_codec *c, const uint8_t *data, int size, unhvd_point_cloud *pc)
+{
+	unhvd_cloud_header h;
+
+	if(size < UNHVD_CLOUD_HEADER_SIZE || unhvd_cloud_parse_header(data, &h) != UNHVD_OK)
+		return UNHVD_ERROR;
+
+	if(size < UNHVD_CLOUD_HEADER_SIZE + h.payload_size)
+		return UNHVD_CLOUD_ERROR_MSG("truncated point cloud message");
+
+	if(h.points > pc->size)
+		return UNHVD_CLOUD_ERROR_MSG("point cloud too small for decoded message");
+
+	const bool colors = h.flags & UNHVD_CLOUD_FLAG_COLORS;
+
+	const uint8_t *in = data + UNHVD_CLOUD_HEADER_SIZE;
+	const uint8_t *end = in + h.payload_size;
+
+	if(h.flags & UNHVD_CLOUD_FLAG_ENTROPY)
+	{
+		int raw_size;
+
+		if(entropy_decode(c, in, end, h.points * UNHVD_CLOUD_MAX_POINT_SIZE, &raw_size) != UNHVD_OK)
+			return UNHVD_CLOUD_ERROR_MSG("corrupted point cloud message entropy coding");
+
+		in = c->raw.data();
+		end = in + raw_size;
+	}
+
+	int32_t prev[3] = {0, 0, 0};
+	uint32_t prev_color = 0;
+
+	for(int i=0;i<h.points;++i)
+	{
+		for(int j=0;j<3;++j)
+		{
+			uint32_t v;
+
+			if( (in = read_varint(in, end, &v)) == NULL)
+				return UNHVD_CLOUD_ERROR_MSG("corrupted point cloud message payload");
+
+			const int32_t q = (int32_t)((uint32_t)prev[j] + (uint32_t)unzigzag(v));
+
+			pc->data[i][j] = q * h.quantization;
+			prev[j] = q;
+		}
+
+		if(colors)
+		{
+			uint32_t color;
+
+			if( (in = read_color(in, end, prev_color, &color)) == NULL)
+				return UNHVD_CLOUD_ERROR_MSG("corrupted point cloud message payload");
+
+			if(pc->colors)
+				pc->colors[i] = color;
+
+			prev_color = color;
+		}
+	}
+
+	pc->used = h.points;
+
+	return UNHVD_OK;
+}
+
+static int UNHVD_CLOUD_ERROR_MSG(const char *msg)
+{
+	cerr << "unhvd_cloud_codec: " << msg << endl;
+	return UNHVD_ERROR;
+}
@@ -0,0 +1,143 @@
+/*
+ * UNHVD point cloud codec library header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_CLOUD_CODEC_H
+#define UNHVD_CLOUD_CODEC_H
+
+#include "unhvd.h"
+
+/**
+ ******************************************************************************
+ *
+ *  \file       unhvd_cloud_codec.h
+ *  \brief      Point cloud wire format encoder/decoder
+ *
+ *  Compact format used for re-streaming unprojected point clouds.
+ *
+ *  Each message is a fixed size header followed by payload:
+ *  - positions are quantized to integer multiples of quantization step
+ *  - positions are coded as delta against previous point of the same message
+ *  - colors are coded per channel the same way
+ *  - deltas are zigzag mapped and written as variable length integers
+ *  - the bytes are entropy coded (order 0 rANS with per message frequency table)
+ *    if that makes the payload smaller
+ *
+ *  Every message is self contained (intra only), decoding may start from any message
+ *  and lost or skipped messages don't affect the following ones.
+ *
+ ******************************************************************************
+ */
+
+extern "C"{
+
+/** \addtogroup cloud_codec Point cloud codec
+ *  @{
+ */
+
+/**
+ * @struct unhvd_cloud_codec
+ * @brief Internal codec data (encoder or decoder state) passed around by the user.
+ * @see unhvd_cloud_codec_init, unhvd_cloud_codec_close
+ */
+struct unhvd_cloud_codec;
+
+enum UNHVD_CLOUD_CODEC_CONSTANTS
+{
+	UNHVD_CLOUD_HEADER_SIZE = 28, //!< size of message header in bytes
+	UNHVD_CLOUD_FLAG_COLORS = 1, //!< message contains colors
+	UNHVD_CLOUD_FLAG_ENTROPY = 2 //!< payload is entropy coded
+};
+
+/**
+ * @struct unhvd_cloud_header
+ * @brief Decoded message header.
+ * @see unhvd_cloud_parse_header
+ */
+struct unhvd_cloud_header
+{
+	int flags; //!< UNHVD_CLOUD_FLAG_COLORS and UNHVD_CLOUD_FLAG_ENTROPY bits
+	int points; //!< number of points in the message
+	float quantization; //!< position quantization step
+	int64_t pts; //!< timestamp of the point cloud
+	int payload_size; //!< number of bytes following the header
+};
+
+/**
+ * @brief Initialize codec.
+ *
+ * The same structure is used for encoding and decoding (but not both at the same time).
+ *
+ * @param quantization position quantization step in point cloud unit (e.g. 0.001 for millimeters with meters), ignored by decoder
+ * @return
+ * - pointer to internal codec data
+ * - NULL on error, errors printed to stderr
+ */
+UNHVD_EXPORT UNHVD_API struct unhvd_cloud_codec *unhvd_cloud_codec_init(float quantization);
+
+/**
+ * @brief Free codec resources.
+ * @param c pointer to internal codec data
+ */
+UNHVD_EXPORT UNHVD_API void unhvd_cloud_codec_close(unhvd_cloud_codec *c);
+
+/**
+ * @brief Maximum size of message for number of points.
+ * @param points number of points
+ * @return size in bytes
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_cloud_encode_bound(int points);
+
+/**
+ * @brief Encode used points of point cloud.
+ *
+ * @param c pointer to internal codec data
+ * @param pc point cloud (colors may be NULL)
+ * @param pts timestamp of the point cloud
+ * @param out output buffer
+ * @param out_size size of output buffer, at least ::unhvd_cloud_encode_bound
+ * @return
+ * - number of bytes written on success
+ * - UNHVD_ERROR on error
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_cloud_encode(unhvd_cloud_codec *c, const unhvd_point_cloud *pc, int64_t pts,
+	uint8_t *out, int out_size);
+
+/**
+ * @brief Parse message header.
+ * @param data at least UNHVD_CLOUD_HEADER_SIZE bytes
+ * @param header header to fill
+ * @return
+ * - UNHVD_OK on success
+ * - UNHVD_ERROR if data is not a valid header
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_cloud_parse_header(const uint8_t *data, unhvd_cloud_header *header);
+
+/**
+ * @brief Decode message.
+ *
+ * Point cloud data and colors have to hold at least unhvd_cloud_header::points elements.
+ * On success pc->used is set to the number of decoded points.
+ * Colors are decoded only if pc->colors is not NULL.
+ *
+ * @param c pointer to internal codec data
+ * @param data message (header and payload)
+ * @param size size of message
+ * @param pc point cloud to fill
+ * @return
+ * - UNHVD_OK on success
+ * - UNHVD_ERROR on error (e.g. corrupted message)
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_cloud_decode(unhvd_cloud_codec *c, const uint8_t *data, int size, unhvd_point_cloud *pc);
+
+/** @}*/
+}
+
+#endif
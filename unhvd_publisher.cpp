@@ -0,0 +1,287 @@
+/*
+ * UNHVD point cloud publisher internal implementation
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "unhvd_publisher.h"
+#include "unhvd_cloud_codec.h"
+#include "unhvd_thread.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <string>
+#include <algorithm> //max
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> //TCP_NODELAY
+#include <arpa/inet.h> //inet_pton
+#include <fcntl.h>
+#include <unistd.h> //close
+#include <errno.h>
+#include <string.h> //memset
+
+using namespace std;
+
+//subscribers that can't receive message within this time are disconnected
+static const int UNHVD_PUBLISHER_SEND_TIMEOUT_MS = 1000;
+//how often publisher thread checks for new subscribers when idle
+static const int UNHVD_PUBLISHER_POLL_MS = 100;
+
+struct unhvd_publisher
+{
+	int listen_fd;
+	unhvd_cloud_codec *codec;
+
+	vector<uint8_t> encoded; //decoding thread only, only grows
+	vector<uint8_t> outgoing; //guarded by mutex
+	int outgoing_size;
+	bool has_outgoing;
+
+	std::mutex mutex; //guards outgoing, outgoing_size and has_outgoing
+	std::condition_variable cv;
+
+	std::atomic<int> subscribers;
+
+	vector<int> clients; //publisher thread only, subscriber sockets
+
+	unhvd_thread_config thread_config;
+	string thread_name;
+	unhvd_thread_state thread_state;
+
+	thread publisher_thread;
+	std::atomic<bool> keep_working;
+
+	unhvd_publisher():
+		listen_fd(-1),
+		codec(NULL),
+		outgoing_size(0),
+		has_outgoing(false),
+		subscribers(0),
+		thread_config(),
+		keep_working(true)
+	{}
+};
+
+static void unhvd_publisher_thread(unhvd_publisher *p);
+static void unhvd_publisher_accept(unhvd_publisher *p);
+static bool unhvd_publisher_send_all(int fd, const uint8_t *data, size_t size);
+static unhvd_publisher *unhvd_publisher_close_and_return_null(unhvd_publisher *p, const char *msg);
+
+unhvd_publisher *unhvd_publisher_init(const unhvd_publish_config *config, const unhvd_thread_config *thread_config)
+{
+	unhvd_publisher *p = new unhvd_publisher();
+
+	if(p == NULL)
+		return unhvd_publisher_close_and_return_null(NULL, "not enough memory for publisher");
+
+	if( (p->codec = unhvd_cloud_codec_init(config->quantization)) == NULL)
+		return unhvd_publisher_close_and_return_null(p, "failed to initialize point cloud codec");
+
+	//applied by thread on start, user pointer may not outlive init
+	p->thread_config = *thread_config;
+	p->thread_name = thread_config->name ? thread_config->name : "";
+	p->thread_config.name = p->thread_name.c_str();
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(config->port);
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if(config->ip && config->ip[0] && inet_pton(AF_INET, config->ip, &address.sin_addr) != 1)
+		return unhvd_publisher_close_and_return_null(p, "failed to parse publisher IP");
+
+	if( (p->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		return unhvd_publisher_close_and_return_null(p, "failed to create publisher socket");
+
+	const int reuse = 1;
+	setsockopt(p->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if(bind(p->listen_fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+		return unhvd_publisher_close_and_return_null(p, "failed to bind publisher socket");
+
+	if(listen(p->listen_fd, 8) == -1)
+		return unhvd_publisher_close_and_return_null(p, "failed to listen on publisher socket");
+
+	if(fcntl(p->listen_fd, F_SETFL, fcntl(p->listen_fd, F_GETFL, 0) | O_NONBLOCK) == -1)
+		return unhvd_publisher_close_and_return_null(p, "failed to set publisher socket non-blocking");
+
+	p->publisher_thread = thread(unhvd_publisher_thread, p);
+
+	return p;
+}
+
+int unhvd_publisher_publish(unhvd_publisher *p, const unhvd_point_cloud *pc, int64_t pts, unhvd_stats *stats)
+{
+	stats->publish_subscribers = p->subscribers;
+	unhvd_thread_state_read(&p->thread_state, &stats->publisher_thread_cpu,
+		&stats->publisher_thread_policy, &stats->publisher_thread_priority);
+
+	if(stats->publish_subscribers == 0)
+		return UNHVD_OK;
+
+	//bound for point cloud capacity, not the fluctuating number of used points,
+	//each of rotating buffers grows once per resolution (no allocation in steady state)
+	const int bound = unhvd_cloud_encode_bound(pc->size);
+	if((int)p->encoded.size() < bound)
+		p->encoded.resize(bound);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	const int size = unhvd_cloud_encode(p->codec, pc, pts, p->encoded.data(), p->encoded.size());
+
+	const int elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	if(size < 0)
+		return UNHVD_ERROR;
+
+	++stats->published;
+	stats->publish_bytes += size;
+	stats->publish_raw_bytes += (uint64_t)pc->used * (sizeof(float3) + sizeof(color32));
+	stats->publish_encode_us += elapsed_us;
+	stats->publish_encode_max_us = max(stats->publish_encode_max_us, elapsed_us);
+
+	{	//hand over to publisher thread, swap keeps both buffers allocated
+		std::lock_guard<std::mutex> guard(p->mutex);
+
+		//previous not sent yet, latest wins (messages are self contained)
+		if(p->has_outgoing)
+			++stats->publish_dropped;
+
+		p->outgoing.swap(p->encoded);
+		p->outgoing_size = size;
+		p->has_outgoing = true;
+	}
+
+	p->cv.notify_one();
+
+	return UNHVD_OK;
+}
+
+static void unhvd_publisher_thread(unhvd_publisher *p)
+{
+	vector<uint8_t> sending;
+
+	unhvd_thread_setup(&p->thread_config);
+	unhvd_thread_state_update(&p->thread_state);
+
+	while(p->keep_working)
+	{
+		int size = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(p->mutex);
+
+			p->cv.wait_for(lock, std::chrono::milliseconds(UNHVD_PUBLISHER_POLL_MS),
+				[p]{ return p->has_outgoing || !p->keep_working; });
+
+			if(p->has_outgoing)
+			{
+				sending.swap(p->outgoing);
+				size = p->outgoing_size;
+				p->has_outgoing = false;
+			}
+		}
+
+		unhvd_publisher_accept(p);
+
+		if(size == 0)
+			continue;
+
+		p->thread_state.cpu = unhvd_thread_cpu();
+
+		for(size_t i=0;i<p->clients.size();)
+		{
+			if(unhvd_publisher_send_all(p->clients[i], sending.data(), size))
+			{
+				++i;
+				continue;
+			}
+
+			//slow or disconnected subscriber
+			close(p->clients[i]);
+			p->clients.erase(p->clients.begin() + i);
+			p->subscribers = p->clients.size();
+		}
+	}
+}
+
+static void unhvd_publisher_accept(unhvd_publisher *p)
+{
+	int fd;
+
+	while( (fd = accept(p->listen_fd, NULL, NULL)) != -1)
+	{
+		const int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+		struct timeval timeout = {UNHVD_PUBLISHER_SEND_TIMEOUT_MS / 1000, (UNHVD_PUBLISHER_SEND_TIMEOUT_MS % 1000) * 1000};
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		p->clients.push_back(fd);
+		p->subscribers = p->clients.size();
+	}
+}
+
+static bool unhvd_publisher_send_all(int fd, const uint8_t *data, size_t size)
+{
+	while(size)
+	{
+		const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return false;
+
+		data += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+static unhvd_publisher *unhvd_publisher_close_and_return_null(unhvd_publisher *p, const char *msg)
+{
+	if(msg)
+		cerr << "unhvd: " << msg << endl;
+
+	unhvd_publisher_close(p);
+
+	return NULL;
+}
+
+void unhvd_publisher_close(unhvd_publisher *p)
+{
+	if(p == NULL)
+		return;
+
+	p->keep_working = false;
+	p->cv.notify_one();
+
+	if(p->publisher_thread.joinable())
+		p->publisher_thread.join();
+
+	for(size_t i=0;i<p->clients.size();++i)
+		close(p->clients[i]);
+
+	if(p->listen_fd != -1)
+		close(p->listen_fd);
+
+	unhvd_cloud_codec_close(p->codec);
+
+	delete p;
+}
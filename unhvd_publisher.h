@@ -0,0 +1,34 @@
+/*
+ * UNHVD point cloud publisher internal header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_PUBLISHER_H
+#define UNHVD_PUBLISHER_H
+
+#include "unhvd.h"
+
+// Re-streams point clouds to TCP subscribers in unhvd_cloud_codec format.
+//
+// Point clouds are encoded on the caller (decoding) thread, after the set
+// was published to local consumers, and handed over to the publisher thread
+// which accepts subscribers and sends the data.
+// If publisher thread is still sending when the next point cloud comes
+// the unsent one is replaced (latest wins). Messages are self contained,
+// new subscribers start receiving from the next message.
+
+struct unhvd_publisher;
+
+unhvd_publisher *unhvd_publisher_init(const unhvd_publish_config *config, const unhvd_thread_config *thread_config);
+void unhvd_publisher_close(unhvd_publisher *p);
+
+// Called from the decoding thread, updates publishing statistics.
+int unhvd_publisher_publish(unhvd_publisher *p, const unhvd_point_cloud *pc, int64_t pts, unhvd_stats *stats);
+
+#endif
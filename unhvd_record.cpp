@@ -0,0 +1,264 @@
+/*
+ * UNHVD recording reader library implementation
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "unhvd_record.h"
+#include "unhvd_record_format.h"
+
+#include <vector>
+#include <iostream>
+#include <algorithm> //lower_bound
+#include <string.h> //memset, memcpy
+
+#include <sys/mman.h> //note that this is not portable
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct unhvd_record_reader
+{
+	int fd;
+	const uint8_t *data;
+	uint64_t size;
+	vector<unhvd_record_index_entry> index;
+
+	unhvd_record_reader():
+		fd(-1),
+		data(NULL),
+		size(0)
+	{}
+};
+
+static bool unhvd_record_load_index(unhvd_record_reader *r);
+static void unhvd_record_scan_index(unhvd_record_reader *r);
+static bool unhvd_record_valid_chunk(const unhvd_record_reader *r, uint64_t offset);
+static bool unhvd_record_in_chunk(uint64_t offset, uint64_t size, uint64_t chunk_size);
+static unhvd_record_reader *unhvd_record_close_and_return_null(unhvd_record_reader *r, const char *msg);
+
+struct unhvd_record_reader *unhvd_record_open(const char *path)
+{
+	unhvd_record_reader *r = new unhvd_record_reader();
+
+	if(r == NULL)
+		return unhvd_record_close_and_return_null(NULL, "not enough memory for recording reader");
+
+	if( (r->fd = open(path, O_RDONLY)) == -1)
+		return unhvd_record_close_and_return_null(r, "failed to open recording");
+
+	struct stat st;
+
+	if(fstat(r->fd, &st) == -1)
+		return unhvd_record_close_and_return_null(r, "failed to stat recording");
+
+	r->size = st.st_size;
+
+	if(r->size < sizeof(unhvd_record_file_header))
+		return unhvd_record_close_and_return_null(r, "recording too short");
+
+	void *mapping = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+
+	if(mapping == MAP_FAILED)
+		return unhvd_record_close_and_return_null(r, "failed to map recording");
+
+	r->data = (const uint8_t*)mapping;
+
+	unhvd_record_file_header header;
+	memcpy(&header, r->data, sizeof(header));
+
+	if(header.magic != UNHVD_RECORD_MAGIC || header.version != UNHVD_RECORD_VERSION)
+		return unhvd_record_close_and_return_null(r, "not a recording or unsupported version");
+
+	if(!unhvd_record_load_index(r))
+	{	//not closed properly, recover what is complete
+		cerr << "unhvd_record: recording has no index, scanning" << endl;
+		unhvd_record_scan_index(r);
+	}
+
+	return r;
+}
+
+//index written on close, false if missing or inconsistent
+static bool unhvd_record_load_index(unhvd_record_reader *r)
+{
+	unhvd_record_trailer trailer;
+
+	if(r->size < sizeof(unhvd_record_file_header) + sizeof(trailer))
+		return false;
+
+	memcpy(&trailer, r->data + r->size - sizeof(trailer), sizeof(trailer));
+
+	if(trailer.magic != UNHVD_RECORD_TRAILER_MAGIC)
+		return false;
+
+	const uint64_t index_end = r->size - sizeof(trailer);
+
+	if(trailer.index_offset > index_end ||
+		trailer.entries > (index_end - trailer.index_offset) / sizeof(unhvd_record_index_entry))
+		return false;
+
+	r->index.resize(trailer.entries);
+	memcpy(r->index.data(), r->data + trailer.index_offset, trailer.entries * sizeof(unhvd_record_index_entry));
+
+	for(size_t i=0;i<r->index.size();++i)
+		if(!unhvd_record_valid_chunk(r, r->index[i].offset) || (i && r->index[i].sequence < r->index[i-1].sequence))
+		{
+			r->index.clear();
+			return false;
+		}
+
+	return true;
+}
+
+//walk the chunks up to the first incomplete one
+static void unhvd_record_scan_index(unhvd_record_reader *r)
+{
+	uint64_t offset = sizeof(unhvd_record_file_header);
+
+	while(unhvd_record_valid_chunk(r, offset))
+	{
+		unhvd_record_chunk_header chunk;
+		memcpy(&chunk, r->data + offset, sizeof(chunk));
+
+		if(!r->index.empty() && chunk.sequence < r->index.back().sequence)
+			break;
+
+		const unhvd_record_index_entry entry = {chunk.sequence, offset};
+		r->index.push_back(entry);
+
+		offset += chunk.size;
+	}
+}
+
+static bool unhvd_record_valid_chunk(const unhvd_record_reader *r, uint64_t offset)
+{
+	unhvd_record_chunk_header chunk;
+
+	if(offset % UNHVD_RECORD_ALIGNMENT || offset > r->size || r->size - offset < sizeof(chunk))
+		return false;
+
+	memcpy(&chunk, r->data + offset, sizeof(chunk));
+
+	return chunk.magic == UNHVD_RECORD_CHUNK_MAGIC &&
+		chunk.size >= sizeof(chunk) && chunk.size % UNHVD_RECORD_ALIGNMENT == 0 &&
+		chunk.size <= r->size - offset &&
+		chunk.frames <= (uint32_t)UNHVD_RECORD_MAX_FRAMES;
+}
+
+//true if [offset, offset + size) lies within chunk
+static bool unhvd_record_in_chunk(uint64_t offset, uint64_t size, uint64_t chunk_size)
+{
+	return offset <= chunk_size && size <= chunk_size - offset;
+}
+
+void unhvd_record_close(unhvd_record_reader *r)
+{
+	if(r == NULL)
+		return;
+
+	if(r->data)
+		munmap((void*)r->data, r->size);
+
+	if(r->fd != -1)
+		close(r->fd);
+
+	delete r;
+}
+
+int unhvd_record_entries(const unhvd_record_reader *r)
+{
+	return r ? (int)r->index.size() : 0;
+}
+
+int unhvd_record_find(const unhvd_record_reader *r, uint64_t sequence)
+{
+	if(r == NULL)
+		return UNHVD_ERROR;
+
+	const unhvd_record_index_entry key = {sequence, 0};
+
+	vector<unhvd_record_index_entry>::const_iterator it = lower_bound(r->index.begin(), r->index.end(), key,
+		[](const unhvd_record_index_entry &a, const unhvd_record_index_entry &b){ return a.sequence < b.sequence; });
+
+	return it == r->index.end() ? UNHVD_ERROR : (int)(it - r->index.begin());
+}
+
+int unhvd_record_read(const unhvd_record_reader *r, int index, unhvd_record_entry *entry)
+{
+	if(r == NULL || entry == NULL || index < 0 || index >= (int)r->index.size())
+		return UNHVD_ERROR;
+
+	//chunk header was validated when building index
+	const uint8_t *base = r->data + r->index[index].offset;
+	unhvd_record_chunk_header chunk;
+	memcpy(&chunk, base, sizeof(chunk));
+
+	if(!unhvd_record_in_chunk(sizeof(chunk), chunk.frames * sizeof(unhvd_record_frame_header), chunk.size))
+		return UNHVD_ERROR;
+
+	memset(entry, 0, sizeof(*entry));
+
+	entry->sequence = chunk.sequence;
+	entry->pts = chunk.pts;
+	entry->frames = chunk.frames;
+
+	for(uint32_t i=0;i<chunk.frames;++i)
+	{
+		unhvd_record_frame_header fh;
+		memcpy(&fh, base + sizeof(chunk) + i * sizeof(fh), sizeof(fh));
+
+		unhvd_frame *frame = &entry->frame[i];
+		unhvd_frame_info *info = &entry->info[i];
+
+		frame->width = fh.width;
+		frame->height = fh.height;
+		frame->format = fh.format;
+		info->pts = fh.pts;
+		info->corrupt = fh.corrupt;
+		info->fresh = fh.planes > 0;
+
+		if(fh.planes < 0 || fh.planes > UNHVD_RECORD_MAX_PLANES)
+			return UNHVD_ERROR;
+
+		for(int p=0;p<fh.planes;++p)
+		{
+			if(!unhvd_record_in_chunk(fh.offset[p], fh.size[p], chunk.size))
+				return UNHVD_ERROR;
+
+			//the mapping is read only, the type matches unhvd_frame
+			frame->data[p] = (uint8_t*)(base + fh.offset[p]);
+			frame->linesize[p] = fh.linesize[p];
+		}
+	}
+
+	if(chunk.points_offset)
+	{
+		if(!unhvd_record_in_chunk(chunk.points_offset, (uint64_t)chunk.points * sizeof(float3), chunk.size) ||
+			!unhvd_record_in_chunk(chunk.colors_offset, (uint64_t)chunk.points * sizeof(color32), chunk.size))
+			return UNHVD_ERROR;
+
+		entry->pc.data = (float3*)(base + chunk.points_offset);
+		entry->pc.colors = (color32*)(base + chunk.colors_offset);
+		entry->pc.size = entry->pc.used = chunk.points;
+	}
+
+	return UNHVD_OK;
+}
+
+static unhvd_record_reader *unhvd_record_close_and_return_null(unhvd_record_reader *r, const char *msg)
+{
+	if(msg)
+		cerr << "unhvd_record: " << msg << endl;
+
+	unhvd_record_close(r);
+
+	return NULL;
+}
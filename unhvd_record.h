@@ -0,0 +1,119 @@
+/*
+ * UNHVD recording reader library header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_RECORD_H
+#define UNHVD_RECORD_H
+
+#include "unhvd.h"
+
+/**
+ ******************************************************************************
+ *
+ *  \file       unhvd_record.h
+ *  \brief      Reader of recordings made with ::unhvd_record_config
+ *
+ *  Recording holds sets of decoded frames and unprojected point clouds
+ *  identified by sequence number (number of sets published before).
+ *  Sequence numbers grow but have gaps where recorder could not keep up.
+ *
+ *  The file is memory mapped, returned frames and point clouds point
+ *  directly to the mapping and are valid until ::unhvd_record_close.
+ *  The data is read only.
+ *
+ *  Recordings that were not closed properly (e.g. crash) are readable
+ *  up to the last complete set.
+ *
+ ******************************************************************************
+ */
+
+extern "C"{
+
+/** \addtogroup record Recording reader
+ *  @{
+ */
+
+/**
+ * @struct unhvd_record_reader
+ * @brief Internal reader data passed around by the user.
+ * @see unhvd_record_open, unhvd_record_close
+ */
+struct unhvd_record_reader;
+
+/**
+ * @struct unhvd_record_entry
+ * @brief Recorded set.
+ *
+ * Frames are filled like in ::unhvd_get_begin and ::unhvd_get_frame_info,
+ * frames that had no data when recorded (or were exported as dmabuf) have NULL data.
+ * Point cloud has NULL data if it was not recorded.
+ *
+ * @see unhvd_record_read
+ */
+struct unhvd_record_entry
+{
+	uint64_t sequence; //!< set sequence number
+	int64_t pts; //!< timestamp of the first frame
+	int frames; //!< number of valid entries in frame array
+	unhvd_frame frame[UNHVD_MAX_DECODERS]; //!< recorded frames
+	unhvd_frame_info info[UNHVD_MAX_DECODERS]; //!< recorded frames information (without dmabuf)
+	unhvd_point_cloud pc; //!< recorded point cloud
+};
+
+/**
+ * @brief Open recording.
+ * @param path recording file
+ * @return
+ * - pointer to internal reader data
+ * - NULL on error, errors printed to stderr
+ */
+UNHVD_EXPORT UNHVD_API struct unhvd_record_reader *unhvd_record_open(const char *path);
+
+/**
+ * @brief Unmap and close recording.
+ * @param r pointer to internal reader data
+ */
+UNHVD_EXPORT UNHVD_API void unhvd_record_close(unhvd_record_reader *r);
+
+/**
+ * @brief Number of recorded sets.
+ * @param r pointer to internal reader data
+ * @return number of sets, indexed from 0
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_record_entries(const unhvd_record_reader *r);
+
+/**
+ * @brief Find set by sequence number.
+ * @param r pointer to internal reader data
+ * @param sequence set sequence number
+ * @return
+ * - index of the first set with sequence number not less than requested
+ * - UNHVD_ERROR if there is no such set
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_record_find(const unhvd_record_reader *r, uint64_t sequence);
+
+/**
+ * @brief Read set.
+ *
+ * Constant time, only headers of the set are touched.
+ *
+ * @param r pointer to internal reader data
+ * @param index set index from 0 to ::unhvd_record_entries - 1
+ * @param entry entry to fill
+ * @return
+ * - UNHVD_OK on success
+ * - UNHVD_ERROR on error (index out of range, corrupted set)
+ */
+UNHVD_EXPORT UNHVD_API int unhvd_record_read(const unhvd_record_reader *r, int index, unhvd_record_entry *entry);
+
+/** @}*/
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * UNHVD recording file format internal header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_RECORD_FORMAT_H
+#define UNHVD_RECORD_FORMAT_H
+
+#include <stdint.h>
+
+// Recording is a sequence of 64 byte aligned blocks (little endian):
+//
+// file header | chunk | chunk | ... | index entries | trailer
+//
+// Each chunk holds one set: chunk header, frame headers, frame planes,
+// point cloud positions and colors. Offsets are relative to chunk start
+// and every plane and array is 64 byte aligned so that mapped file can be
+// used directly. Index and trailer are written when recording is closed,
+// without them (e.g. crash) reader recovers index by walking the chunks.
+
+//"UREC", "USET", "UEND" little endian
+const uint32_t UNHVD_RECORD_MAGIC = 0x43455255;
+const uint32_t UNHVD_RECORD_CHUNK_MAGIC = 0x54455355;
+const uint32_t UNHVD_RECORD_TRAILER_MAGIC = 0x444E4555;
+const uint32_t UNHVD_RECORD_VERSION = 1;
+
+const uint64_t UNHVD_RECORD_ALIGNMENT = 64;
+
+//max frames per chunk, max planes per frame
+const int UNHVD_RECORD_MAX_FRAMES = 3;
+const int UNHVD_RECORD_MAX_PLANES = 3;
+
+struct unhvd_record_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint8_t reserved[56];
+};
+
+struct unhvd_record_chunk_header
+{
+	uint32_t magic;
+	uint32_t frames;
+	uint64_t sequence;
+	int64_t pts;
+	uint64_t size; //whole chunk including headers and padding
+	uint32_t points;
+	uint32_t reserved;
+	uint64_t points_offset; //0 if there is no point cloud
+	uint64_t colors_offset;
+	uint64_t reserved2;
+};
+
+struct unhvd_record_frame_header
+{
+	int32_t width;
+	int32_t height;
+	int32_t format;
+	int32_t planes;
+	int32_t linesize[UNHVD_RECORD_MAX_PLANES];
+	int32_t corrupt;
+	int64_t pts;
+	uint64_t offset[UNHVD_RECORD_MAX_PLANES];
+	uint64_t size[UNHVD_RECORD_MAX_PLANES];
+	uint64_t reserved;
+};
+
+struct unhvd_record_index_entry
+{
+	uint64_t sequence;
+	uint64_t offset; //chunk offset in file
+};
+
+struct unhvd_record_trailer
+{
+	uint64_t index_offset;
+	uint64_t entries;
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t reserved2;
+};
+
+static_assert(sizeof(unhvd_record_file_header) == 64, "unexpected file header size");
+static_assert(sizeof(unhvd_record_chunk_header) == 64, "unexpected chunk header size");
+static_assert(sizeof(unhvd_record_frame_header) == 96, "unexpected frame header size");
+static_assert(sizeof(unhvd_record_index_entry) == 16, "unexpected index entry size");
+static_assert(sizeof(unhvd_record_trailer) == 32, "unexpected trailer size");
+
+static inline uint64_t unhvd_record_align(uint64_t size)
+{
+	return (size + UNHVD_RECORD_ALIGNMENT - 1) & ~(UNHVD_RECORD_ALIGNMENT - 1);
+}
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * UNHVD recorder internal implementation
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "unhvd_recorder.h"
+#include "unhvd_record_format.h"
+#include "unhvd_thread.h"
+
+#include "nhvd.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <string>
+#include <algorithm> //min
+#include <new> //nothrow
+#include <string.h> //memset, memcpy
+
+#include <fcntl.h> //note that this is not portable
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+//sets buffered for writing if not configured
+static const int UNHVD_RECORDER_DEFAULT_QUEUE = 8;
+
+//chunk headers and point cloud are copied, frames are referenced (planes are written from them)
+struct unhvd_record_buffer
+{
+	uint8_t *data; //headers followed by point cloud, only grows (not zero filled)
+	uint64_t capacity;
+	uint64_t header_size; //chunk and frame headers with padding
+	uint64_t size; //used data
+	uint64_t sequence;
+	int frames;
+	AVFrame *frame[UNHVD_RECORD_MAX_FRAMES]; //references to recorded frames
+	unhvd_record_frame_header fh[UNHVD_RECORD_MAX_FRAMES];
+	bool has_point_cloud;
+	unhvd_point_cloud pc; //copied on commit
+	uint64_t colors_offset; //relative to points
+};
+
+struct unhvd_recorder
+{
+	int fd;
+
+	vector<unhvd_record_buffer*> buffers; //all buffers, owned
+	vector<unhvd_record_buffer*> free_buffers; //guarded by mutex
+	//ring of buffers waiting for writing, guarded by mutex
+	//(preallocated, deque would allocate blocks on the decoding thread)
+	vector<unhvd_record_buffer*> queue;
+	int queue_head;
+	int queue_count;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	//decoding thread only, recorded set waiting for commit or NULL
+	unhvd_record_buffer *prepared;
+
+	//recorder thread only
+	uint64_t offset;
+	vector<unhvd_record_index_entry> index;
+	bool failed;
+
+	std::atomic<uint64_t> recorded;
+	std::atomic<uint64_t> bytes;
+
+	unhvd_thread_config thread_config;
+	string thread_name;
+	unhvd_thread_state thread_state;
+
+	thread recorder_thread;
+	std::atomic<bool> keep_working;
+
+	unhvd_recorder():
+		fd(-1),
+		prepared(NULL),
+		offset(0),
+		failed(false),
+		recorded(0),
+		bytes(0),
+		thread_config(),
+		keep_working(true)
+	{}
+};
+
+static void unhvd_recorder_thread(unhvd_recorder *r);
+static bool unhvd_recorder_write_all(unhvd_recorder *r, const uint8_t *data, uint64_t size);
+static void unhvd_recorder_write_index(unhvd_recorder *r);
+static uint64_t unhvd_recorder_plane_height(const AVFrame *frame, int plane);
+static bool unhvd_recorder_write_buffer(unhvd_recorder *r, unhvd_record_buffer *buffer);
+static unhvd_record_buffer *unhvd_record_buffer_new();
+static void unhvd_record_buffer_delete(unhvd_record_buffer *buffer);
+static unhvd_recorder *unhvd_recorder_close_and_return_null(unhvd_recorder *r, const char *msg);
+
+unhvd_recorder *unhvd_recorder_init(const unhvd_record_config *config, const unhvd_thread_config *thread_config)
+{
+	unhvd_recorder *r = new unhvd_recorder();
+
+	if(r == NULL)
+		return unhvd_recorder_close_and_return_null(NULL, "not enough memory for recorder");
+
+	if(config->path == NULL || config->queue_size < 0)
+		return unhvd_recorder_close_and_return_null(r, "invalid record config");
+
+	const int queue_size = config->queue_size ? config->queue_size : UNHVD_RECORDER_DEFAULT_QUEUE;
+
+	for(int i=0;i<queue_size;++i)
+	{
+		unhvd_record_buffer *buffer = unhvd_record_buffer_new();
+
+		if(buffer == NULL)
+			return unhvd_recorder_close_and_return_null(r, "not enough memory for recording buffers");
+
+		r->buffers.push_back(buffer);
+		r->free_buffers.push_back(buffer);
+	}
+
+	r->queue.resize(queue_size);
+	r->queue_head = r->queue_count = 0;
+
+	//applied by thread on start, user pointer may not outlive init
+	r->thread_config = *thread_config;
+	r->thread_name = thread_config->name ? thread_config->name : "";
+	r->thread_config.name = r->thread_name.c_str();
+
+	if( (r->fd = open(config->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return unhvd_recorder_close_and_return_null(r, "failed to create recording file");
+
+	unhvd_record_file_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = UNHVD_RECORD_MAGIC;
+	header.version = UNHVD_RECORD_VERSION;
+
+	if(!unhvd_recorder_write_all(r, (const uint8_t*)&header, sizeof(header)))
+		return unhvd_recorder_close_and_return_null(r, "failed to write recording header");
+
+	r->recorder_thread = thread(unhvd_recorder_thread, r);
+
+	return r;
+}
+
+void unhvd_recorder_record(unhvd_recorder *r, uint64_t sequence, AVFrame * const frames[], int count,
+	const unhvd_point_cloud *pc, unhvd_stats *stats)
+{
+	stats->recorded = r->recorded;
+	stats->record_bytes = r->bytes;
+	unhvd_thread_state_read(&r->thread_state, &stats->recorder_thread_cpu,
+		&stats->recorder_thread_policy, &stats->recorder_thread_priority);
+
+	unhvd_record_buffer *buffer = NULL;
+
+	{
+		std::lock_guard<std::mutex> guard(r->mutex);
+
+		if(!r->free_buffers.empty())
+		{
+			buffer = r->free_buffers.back();
+			r->free_buffers.pop_back();
+		}
+	}
+
+	if(buffer == NULL)
+	{	//writing can't keep up, never block decoding
+		++stats->record_dropped;
+		return;
+	}
+
+	unhvd_record_chunk_header chunk;
+	unhvd_record_frame_header *fh = buffer->fh;
+
+	memset(&chunk, 0, sizeof(chunk));
+	memset(fh, 0, sizeof(buffer->fh));
+
+	count = min(count, UNHVD_RECORD_MAX_FRAMES);
+
+	//layout first, headers and point cloud are copied, planes are referenced
+	const uint64_t header_size = unhvd_record_align(sizeof(chunk) + count * sizeof(unhvd_record_frame_header));
+	uint64_t size = header_size;
+
+	for(int i=0;i<count;++i)
+	{
+		const AVFrame *f = frames[i];
+
+		fh[i].width = f->width;
+		fh[i].height = f->height;
+		fh[i].format = f->format;
+		fh[i].pts = f->pts;
+		fh[i].corrupt = (f->flags & AV_FRAME_FLAG_CORRUPT) || f->decode_error_flags;
+
+		//frames without data, hardware and exported (DRM PRIME) frames have no planes
+		if(!f->data[0] || f->hw_frames_ctx || f->format == AV_PIX_FMT_DRM_PRIME)
+			continue;
+
+		//planes are written from the reference, decoder allocates new frames meanwhile
+		if(av_frame_ref(buffer->frame[i], f) != 0)
+			continue; //no memory for reference, recorded without planes
+
+		for(int p=0;p<UNHVD_RECORD_MAX_PLANES && f->data[p] && f->linesize[p] > 0;++p)
+		{
+			fh[i].linesize[p] = f->linesize[p];
+			fh[i].offset[p] = size;
+			fh[i].size[p] = f->linesize[p] * unhvd_recorder_plane_height(f, p);
+			fh[i].planes = p + 1;
+
+			size = unhvd_record_align(size + fh[i].size[p]);
+		}
+	}
+
+	const int points = pc ? pc->used : 0;
+	//buffer for point cloud capacity, not the fluctuating number of used points,
+	//each buffer grows once per resolution (no allocation in steady state)
+	uint64_t capacity = header_size;
+	uint64_t copied = header_size; //headers and point cloud kept in buffer
+
+	if(pc)
+	{
+		chunk.points_offset = size;
+		size = unhvd_record_align(size + points * sizeof(float3));
+		chunk.colors_offset = size;
+		size = unhvd_record_align(size + points * sizeof(color32));
+
+		copied += size - chunk.points_offset;
+
+		capacity = unhvd_record_align(capacity + pc->size * sizeof(float3));
+		capacity = unhvd_record_align(capacity + pc->size * sizeof(color32));
+	}
+
+	chunk.magic = UNHVD_RECORD_CHUNK_MAGIC;
+	chunk.frames = count;
+	chunk.sequence = sequence;
+	chunk.pts = count ? frames[0]->pts : 0;
+	chunk.size = size;
+	chunk.points = points;
+
+	if(buffer->capacity < capacity)
+	{	//contents are overwritten, no need to zero fill
+		delete [] buffer->data;
+		buffer->data = new (std::nothrow) uint8_t[capacity];
+		buffer->capacity = buffer->data ? capacity : 0;
+	}
+
+	if(buffer->data == NULL)
+	{
+		for(int i=0;i<count;++i)
+			av_frame_unref(buffer->frame[i]);
+
+		std::lock_guard<std::mutex> guard(r->mutex);
+		r->free_buffers.push_back(buffer);
+		++stats->record_dropped;
+		return;
+	}
+
+	uint8_t *out = buffer->data;
+
+	//padding is written too, keep it zero
+	memset(out, 0, header_size);
+	memcpy(out, &chunk, sizeof(chunk));
+	memcpy(out + sizeof(chunk), fh, count * sizeof(unhvd_record_frame_header));
+
+	//point cloud is copied by unhvd_recorder_commit, after the set was published
+	buffer->has_point_cloud = pc != NULL;
+	buffer->pc = pc ? *pc : unhvd_point_cloud();
+	buffer->colors_offset = chunk.colors_offset - chunk.points_offset;
+	buffer->header_size = header_size;
+	buffer->size = copied;
+	buffer->sequence = sequence;
+	buffer->frames = count;
+
+	r->prepared = buffer;
+}
+
+void unhvd_recorder_commit(unhvd_recorder *r)
+{
+	unhvd_record_buffer *buffer = r->prepared;
+
+	if(buffer == NULL)
+		return; //set was dropped
+
+	r->prepared = NULL;
+
+	if(buffer->has_point_cloud)
+	{	//point cloud storage is reused by the decoding thread, it has to be copied
+		const int points = buffer->pc.used;
+		uint8_t *points_out = buffer->data + buffer->header_size;
+		uint8_t *colors_out = points_out + buffer->colors_offset;
+		uint8_t *end = buffer->data + buffer->size;
+
+		memcpy(points_out, buffer->pc.data, points * sizeof(float3));
+		memset(points_out + points * sizeof(float3), 0, colors_out - points_out - points * sizeof(float3));
+		memcpy(colors_out, buffer->pc.colors, points * sizeof(color32));
+		memset(colors_out + points * sizeof(color32), 0, end - colors_out - points * sizeof(color32));
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(r->mutex);
+		r->queue[(r->queue_head + r->queue_count++) % r->queue.size()] = buffer;
+	}
+
+	r->cv.notify_one();
+}
+
+static void unhvd_recorder_thread(unhvd_recorder *r)
+{
+	unhvd_thread_setup(&r->thread_config);
+	unhvd_thread_state_update(&r->thread_state);
+
+	while(true)
+	{
+		unhvd_record_buffer *buffer;
+
+		{
+			std::unique_lock<std::mutex> lock(r->mutex);
+
+			r->cv.wait(lock, [r]{ return r->queue_count || !r->keep_working; });
+
+			//drain the queue before finishing
+			if(r->queue_count == 0)
+				break;
+
+			buffer = r->queue[r->queue_head];
+			r->queue_head = (r->queue_head + 1) % r->queue.size();
+			--r->queue_count;
+		}
+
+		r->thread_state.cpu = unhvd_thread_cpu();
+
+		if(!r->failed)
+		{
+			const unhvd_record_index_entry entry = {buffer->sequence, r->offset};
+
+			if(unhvd_recorder_write_buffer(r, buffer))
+			{
+				r->index.push_back(entry);
+				++r->recorded;
+				r->bytes += r->offset - entry.offset;
+			}
+			else
+			{
+				cerr << "unhvd: failed to write recording, recording stopped" << endl;
+				r->failed = true;
+			}
+		}
+
+		//release decoded frames as soon as possible
+		for(int i=0;i<buffer->frames;++i)
+			av_frame_unref(buffer->frame[i]);
+
+		std::lock_guard<std::mutex> guard(r->mutex);
+		r->free_buffers.push_back(buffer);
+	}
+
+	if(!r->failed)
+		unhvd_recorder_write_index(r);
+}
+
+static void unhvd_recorder_write_index(unhvd_recorder *r)
+{
+	unhvd_record_trailer trailer;
+	memset(&trailer, 0, sizeof(trailer));
+
+	trailer.index_offset = r->offset;
+	trailer.entries = r->index.size();
+	trailer.magic = UNHVD_RECORD_TRAILER_MAGIC;
+
+	if(!unhvd_recorder_write_all(r, (const uint8_t*)r->index.data(), r->index.size() * sizeof(unhvd_record_index_entry)) ||
+		!unhvd_recorder_write_all(r, (const uint8_t*)&trailer, sizeof(trailer)))
+		cerr << "unhvd: failed to write recording index" << endl;
+}
+
+//headers, planes of referenced frames and point cloud in chunk layout order
+static bool unhvd_recorder_write_buffer(unhvd_recorder *r, unhvd_record_buffer *buffer)
+{
+	static const uint8_t padding[UNHVD_RECORD_ALIGNMENT] = {0};
+	const uint64_t chunk_offset = r->offset;
+
+	if(!unhvd_recorder_write_all(r, buffer->data, buffer->header_size))
+		return false;
+
+	for(int i=0;i<buffer->frames;++i)
+		for(int p=0;p<buffer->fh[i].planes;++p)
+		{
+			if(!unhvd_recorder_write_all(r, buffer->frame[i]->data[p], buffer->fh[i].size[p]))
+				return false;
+
+			const uint64_t written = r->offset - chunk_offset;
+
+			if(!unhvd_recorder_write_all(r, padding, unhvd_record_align(written) - written))
+				return false;
+		}
+
+	return unhvd_recorder_write_all(r, buffer->data + buffer->header_size, buffer->size - buffer->header_size);
+}
+
+static bool unhvd_recorder_write_all(unhvd_recorder *r, const uint8_t *data, uint64_t size)
+{
+	while(size)
+	{
+		const ssize_t written = write(r->fd, data, size);
+
+		if(written < 0 && errno == EINTR)
+			continue;
+		if(written <= 0)
+			return false;
+
+		data += written;
+		size -= written;
+		r->offset += written;
+	}
+
+	return true;
+}
+
+//chroma planes of planar formats are subsampled vertically
+static uint64_t unhvd_recorder_plane_height(const AVFrame *frame, int plane)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+
+	if(desc == NULL || (plane != 1 && plane != 2))
+		return frame->height;
+
+	return (frame->height + (1 << desc->log2_chroma_h) - 1) >> desc->log2_chroma_h;
+}
+
+static unhvd_record_buffer *unhvd_record_buffer_new()
+{
+	unhvd_record_buffer *buffer = new (std::nothrow) unhvd_record_buffer();
+
+	if(buffer == NULL)
+		return NULL;
+
+	for(int i=0;i<UNHVD_RECORD_MAX_FRAMES;++i)
+		if( (buffer->frame[i] = av_frame_alloc()) == NULL)
+		{
+			unhvd_record_buffer_delete(buffer);
+			return NULL;
+		}
+
+	return buffer;
+}
+
+static void unhvd_record_buffer_delete(unhvd_record_buffer *buffer)
+{
+	for(int i=0;i<UNHVD_RECORD_MAX_FRAMES;++i)
+		av_frame_free(&buffer->frame[i]);
+
+	delete [] buffer->data;
+	delete buffer;
+}
+
+static unhvd_recorder *unhvd_recorder_close_and_return_null(unhvd_recorder *r, const char *msg)
+{
+	if(msg)
+		cerr << "unhvd: " << msg << endl;
+
+	unhvd_recorder_close(r);
+
+	return NULL;
+}
+
+void unhvd_recorder_close(unhvd_recorder *r)
+{
+	if(r == NULL)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(r->mutex);
+		r->keep_working = false;
+	}
+
+	r->cv.notify_one();
+
+	if(r->recorder_thread.joinable())
+		r->recorder_thread.join();
+
+	if(r->fd != -1)
+		close(r->fd);
+
+	for(size_t i=0;i<r->buffers.size();++i)
+		unhvd_record_buffer_delete(r->buffers[i]);
+
+	delete r;
+}
@@ -0,0 +1,41 @@
+/*
+ * UNHVD recorder internal header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_RECORDER_H
+#define UNHVD_RECORDER_H
+
+#include "unhvd.h"
+
+struct AVFrame;
+
+// Records sets to file in format described in unhvd_record_format.h.
+//
+// Frames are referenced before the set is published and point cloud is copied
+// after that (consumers don't wait for the copy) on the caller (decoding)
+// thread into preallocated buffers, all are written by the recorder thread.
+// If all buffers are waiting for writing the set is dropped (recording never
+// blocks decoding). Index is written on close.
+
+struct unhvd_recorder;
+
+unhvd_recorder *unhvd_recorder_init(const unhvd_record_config *config, const unhvd_thread_config *thread_config);
+void unhvd_recorder_close(unhvd_recorder *r);
+
+// Called from the decoding thread before publishing, frames without data are recorded
+// without planes, pc may be NULL. Updates recording statistics.
+void unhvd_recorder_record(unhvd_recorder *r, uint64_t sequence, AVFrame * const frames[], int count,
+	const unhvd_point_cloud *pc, unhvd_stats *stats);
+
+// Called from the decoding thread after publishing, copies point cloud passed
+// to unhvd_recorder_record (it has to be unchanged) and queues the set for writing.
+void unhvd_recorder_commit(unhvd_recorder *r);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * UNHVD test only internal header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_TEST_H
+#define UNHVD_TEST_H
+
+#include "unhvd.h"
+
+struct AVFrame;
+
+// Synthetic frame injection, available only in library compiled
+// with UNHVD_TESTING (unhvd-testing target used by tests).
+//
+// Source is called by the decoding thread instead of nhvd_receive
+// with the same contract: fill frames array (one entry per decoder)
+// with NULL or frame the library may move the reference from
+// and return NHVD_OK, NHVD_TIMEOUT or NHVD_ERROR (stops decoding).
+// Source should block a while when returning NHVD_TIMEOUT.
+
+typedef int (*unhvd_test_source)(AVFrame *frames[], void *user);
+
+// The same as unhvd_init_pipeline with source in place of network decoder.
+unhvd *unhvd_test_init(unhvd_test_source source, void *source_user, int decoders,
+	const unhvd_depth_config *depth_config, const unhvd_pipeline_config *pipeline_config);
+
+#endif
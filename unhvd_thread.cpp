@@ -0,0 +1,131 @@
+/*
+ * UNHVD pipeline thread scheduling internal implementation
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "unhvd_thread.h"
+
+#include <iostream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h> //setpriority
+#include <sys/syscall.h> //SYS_gettid
+#include <unistd.h>
+#include <errno.h>
+#include <string.h> //strerror, strncpy
+#endif
+
+using namespace std;
+
+#if defined(__linux__)
+static void unhvd_thread_warning(const char *what, int error)
+{
+	cerr << "unhvd: failed to set thread " << what << ": " << strerror(error) << endl;
+}
+#endif
+
+void unhvd_thread_setup(const unhvd_thread_config *config)
+{
+#if defined(__linux__)
+	if(config->name && config->name[0])
+	{	//the name is limited to 16 bytes including terminating null
+		char name[16];
+		strncpy(name, config->name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+
+		int error = pthread_setname_np(pthread_self(), name);
+		if(error)
+			unhvd_thread_warning("name", error);
+	}
+
+	if(config->cpu_mask)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+
+		for(int i=0;i<64;++i)
+			if(config->cpu_mask & ((uint64_t)1 << i))
+				CPU_SET(i, &cpus);
+
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if(error)
+			unhvd_thread_warning("affinity", error);
+	}
+
+	if(config->policy == UNHVD_SCHED_FIFO)
+	{
+		sched_param param = {};
+		param.sched_priority = config->priority;
+
+		int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(error)
+			unhvd_thread_warning("SCHED_FIFO priority", error);
+	}
+	else if(config->priority)
+	{	//nice value applies to the thread when given its id
+		if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), config->priority) == -1)
+			unhvd_thread_warning("nice value", errno);
+	}
+#else
+	if(config->name || config->cpu_mask || config->policy || config->priority)
+		cerr << "unhvd: thread scheduling configuration is only supported on Linux" << endl;
+#endif
+}
+
+void unhvd_thread_scheduling(int *policy, int *priority)
+{
+	*policy = UNHVD_SCHED_DEFAULT;
+	*priority = 0;
+
+#if defined(__linux__)
+	int native_policy;
+	sched_param param;
+
+	if(pthread_getschedparam(pthread_self(), &native_policy, &param) == 0 && native_policy == SCHED_FIFO)
+	{
+		*policy = UNHVD_SCHED_FIFO;
+		*priority = param.sched_priority;
+		return;
+	}
+
+	errno = 0;
+	const int nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+	if(errno == 0)
+		*priority = nice;
+#endif
+}
+
+int unhvd_thread_cpu()
+{
+#if defined(__linux__)
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+void unhvd_thread_state_update(unhvd_thread_state *state)
+{
+	int policy, priority;
+
+	unhvd_thread_scheduling(&policy, &priority);
+
+	state->policy = policy;
+	state->priority = priority;
+	state->cpu = unhvd_thread_cpu();
+}
+
+void unhvd_thread_state_read(const unhvd_thread_state *state, int *cpu, int *policy, int *priority)
+{
+	*cpu = state->cpu;
+	*policy = state->policy;
+	*priority = state->priority;
+}
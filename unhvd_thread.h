@@ -0,0 +1,50 @@
+/*
+ * UNHVD pipeline thread scheduling internal header
+ *
+ * Copyright 2019-2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef UNHVD_THREAD_H
+#define UNHVD_THREAD_H
+
+#include "unhvd.h"
+
+#include <atomic>
+
+// Effective scheduling of background pipeline thread (publisher, recorder),
+// written by the thread and read by the decoding thread for statistics.
+struct unhvd_thread_state
+{
+	std::atomic<int> cpu; //-1 if unknown
+	std::atomic<int> policy;
+	std::atomic<int> priority;
+
+	unhvd_thread_state():
+		cpu(-1),
+		policy(UNHVD_SCHED_DEFAULT),
+		priority(0)
+	{}
+};
+
+// Applies unhvd_thread_config to the calling thread (Linux, no-op elsewhere).
+// Failures are reported on stderr, the thread continues with what was possible.
+void unhvd_thread_setup(const unhvd_thread_config *config);
+
+// Reads back effective policy and priority of the calling thread.
+void unhvd_thread_scheduling(int *policy, int *priority);
+
+// CPU the calling thread runs on or -1 if unknown.
+int unhvd_thread_cpu();
+
+// Reads back effective policy, priority and CPU of the calling thread.
+void unhvd_thread_state_update(unhvd_thread_state *state);
+
+// Copies thread state to statistics fields.
+void unhvd_thread_state_read(const unhvd_thread_state *state, int *cpu, int *policy, int *priority);
+
+#endif